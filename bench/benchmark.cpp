@@ -0,0 +1,411 @@
+/*
+ * Benchmarks for the particle layer.
+ *
+ * Measures Particle::integrate, ParticleForceRegistry::updateForces with each of the force generators, spring chains
+ * and registry add/remove churn over a range of particle counts, and reports the time per particle per step and the
+ * throughput. The results can be saved as a baseline and later runs compared against it. The program exits with 1
+ * when any case has become slower by more than a threshold, and with 2 when the baseline is missing or malformed or
+ * no case of the run is in it. Cases missing from either side are listed.
+ *
+ * Every run uses the same seed and the same amount of work per case, and reports the median of several repeats.
+ *
+ * Usage: tacoTruck-bench [--sizes 1000,10000,...] [--max-size N] [--repeats N] [--baseline FILE]
+ *                        [--threshold PERCENT] [--write-baseline]
+ *
+ */
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "particle.hpp"
+#include "pfgen.hpp"
+
+using namespace tacoTruck;
+
+namespace {
+    /** The number of particle steps each case aims to cover per repeat, whatever the particle count. */
+    const double workPerRepeat = 1e7;
+
+    /** The seed used to lay out the particles, so that every run sees the same scene. */
+    const unsigned seed = 20150706u;
+
+    struct Options {
+        std::vector<unsigned> sizes;
+        unsigned repeats;
+        std::string baseline;
+        double threshold;   /**< Allowed slowdown, as a fraction. */
+        bool writeBaseline;
+
+        Options() : sizes({ 1000, 10000, 100000, 1000000, 10000000 }),
+                    repeats(5),
+                    baseline("bench/baseline.json"),
+                    threshold(0.10),
+                    writeBaseline(false)
+        {}
+    };
+
+    struct Result {
+        std::string name;
+        unsigned size;
+        double nsPerItem;   /**< Nanoseconds per particle per step, or per operation for the churn case. */
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    /** Fills the given particles with a reproducible random scene. */
+    void makeParticles(std::vector<Particle> &particles, unsigned count) {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<real> position(-1000, 1000);
+        std::uniform_real_distribution<real> velocity(-10, 10);
+        std::uniform_real_distribution<real> mass(1, 10);
+        particles.assign(count, Particle());
+        for (unsigned i = 0; i < count; i++) {
+            particles[i].setMass(mass(rng));
+            particles[i].setPosition(position(rng), position(rng));
+            particles[i].setVelocity(velocity(rng), velocity(rng));
+            particles[i].setDamping(0.99f);
+        }
+    }
+
+    /** Runs the given step function the given number of times, several times over, and returns the median time. */
+    template <typename Step>
+    double timeMedian(unsigned repeats, unsigned steps, Step step) {
+        step();     // warm up
+        std::vector<double> times;
+        for (unsigned r = 0; r < repeats; r++) {
+            Clock::time_point start = Clock::now();
+            for (unsigned s = 0; s < steps; s++) step();
+            times.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+        }
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    }
+
+    unsigned stepsFor(unsigned size) {
+        return std::max(1u, (unsigned)(workPerRepeat / size));
+    }
+
+    /** Times updateForces with a single generator registered to every particle. */
+    Result benchGenerator(const char *name, ParticleForceGenerator *fg, std::vector<Particle> &particles,
+                          unsigned repeats) {
+        const unsigned size = (unsigned)particles.size();
+        ParticleForceRegistry registry;
+        for (unsigned i = 0; i < size; i++) registry.add(&particles[i], fg);
+
+        const unsigned steps = stepsFor(size);
+        double ns = timeMedian(repeats, steps, [&]() {
+            registry.updateForces(0.01f);
+        });
+        for (unsigned i = 0; i < size; i++) particles[i].clearAccumulator();
+
+        Result result = { std::string("updateForces/") + name, size, ns / ((double)steps * size) };
+        return result;
+    }
+
+    void benchSize(unsigned size, unsigned repeats, std::vector<Result> &results) {
+        std::vector<Particle> particles;
+        makeParticles(particles, size);
+        const unsigned steps = stepsFor(size);
+
+        // Integration on its own
+        {
+            double ns = timeMedian(repeats, steps, [&]() {
+                for (unsigned i = 0; i < size; i++) particles[i].integrate(0.001f);
+            });
+            Result result = { "integrate", size, ns / ((double)steps * size) };
+            results.push_back(result);
+        }
+
+        // Each force generator
+        {
+            ParticleGravity gravity(Vector2D(0, -9.81f));
+            results.push_back(benchGenerator("gravity", &gravity, particles, repeats));
+            ParticleDrag drag(0.1f, 0.01f);
+            results.push_back(benchGenerator("drag", &drag, particles, repeats));
+            ParticleAirbrake airbrake(0.1f, 0.01f);
+            results.push_back(benchGenerator("airbrake", &airbrake, particles, repeats));
+            ParticleUplift uplift(Vector2D(0, 5), Vector2D(0, 0), 500);
+            results.push_back(benchGenerator("uplift", &uplift, particles, repeats));
+            ParticleAttraction attraction(5, Vector2D(0, 0));
+            results.push_back(benchGenerator("attraction", &attraction, particles, repeats));
+            Vector2D anchor(0, 0);
+            ParticleAnchoredSpring anchored(&anchor, 2, 100);
+            results.push_back(benchGenerator("anchoredSpring", &anchored, particles, repeats));
+        }
+
+        // Springs and bungees each need their own generator, pointing at the next particle along
+        {
+            std::vector<ParticleSpring> springs;
+            std::vector<ParticleBungee> bungees;
+            springs.reserve(size);
+            bungees.reserve(size);
+            ParticleForceRegistry springRegistry;
+            ParticleForceRegistry bungeeRegistry;
+            for (unsigned i = 0; i < size; i++) {
+                Particle *other = &particles[(i + 1) % size];
+                springs.push_back(ParticleSpring(other, 2, 10));
+                bungees.push_back(ParticleBungee(other, 2, 10));
+                springRegistry.add(&particles[i], &springs.back());
+                bungeeRegistry.add(&particles[i], &bungees.back());
+            }
+            double ns = timeMedian(repeats, steps, [&]() { springRegistry.updateForces(0.01f); });
+            Result spring = { "updateForces/spring", size, ns / ((double)steps * size) };
+            results.push_back(spring);
+            ns = timeMedian(repeats, steps, [&]() { bungeeRegistry.updateForces(0.01f); });
+            Result bungee = { "updateForces/bungee", size, ns / ((double)steps * size) };
+            results.push_back(bungee);
+            for (unsigned i = 0; i < size; i++) particles[i].clearAccumulator();
+        }
+
+        // A full step of a spring chain: springs both ways between neighbours, then integration
+        {
+            std::vector<Particle> chain;
+            makeParticles(chain, size);
+            for (unsigned i = 0; i < size; i++) chain[i].setPosition((real)i, 0);
+
+            std::vector<ParticleSpring> springs;
+            springs.reserve(2 * size);
+            ParticleForceRegistry registry;
+            for (unsigned i = 0; i + 1 < size; i++) {
+                springs.push_back(ParticleSpring(&chain[i + 1], 10, 1));
+                registry.add(&chain[i], &springs.back());
+                springs.push_back(ParticleSpring(&chain[i], 10, 1));
+                registry.add(&chain[i + 1], &springs.back());
+            }
+            double ns = timeMedian(repeats, steps, [&]() {
+                registry.updateForces(0.001f);
+                for (unsigned i = 0; i < size; i++) chain[i].integrate(0.001f);
+            });
+            Result result = { "springChain", size, ns / ((double)steps * size) };
+            results.push_back(result);
+        }
+
+        // Churn: remove a random registration and add it back, with the registry holding one per particle
+        {
+            ParticleGravity gravity(Vector2D(0, -9.81f));
+            ParticleForceRegistry registry;
+            for (unsigned i = 0; i < size; i++) registry.add(&particles[i], &gravity);
+
+            // Removal searches the registry, so keep the number of operations bounded on large registries.
+            const unsigned operations = std::max(100u, std::min(100000u, (unsigned)(2e8 / size)));
+            std::mt19937 rng(seed);
+            std::uniform_int_distribution<unsigned> pick(0, size - 1);
+            std::vector<unsigned> order(operations);
+            for (unsigned i = 0; i < operations; i++) order[i] = pick(rng);
+
+            double ns = timeMedian(repeats, 1, [&]() {
+                for (unsigned i = 0; i < operations; i++) {
+                    Particle *particle = &particles[order[i]];
+                    registry.remove(particle, &gravity);
+                    registry.add(particle, &gravity);
+                }
+            });
+            Result result = { "registryChurn", size, ns / operations };
+            results.push_back(result);
+        }
+    }
+
+    std::string key(const Result &result) {
+        std::ostringstream out;
+        out << result.name << "/" << result.size;
+        return out.str();
+    }
+
+    /** Skips whitespace in the given text, starting at pos. */
+    void skipSpace(const std::string &text, size_t &pos) {
+        while (pos < text.size() && std::isspace((unsigned char)text[pos])) pos++;
+    }
+
+    /**
+     *  Reads a baseline file: a flat JSON object mapping each case to its time per item, as written by writeBaseline.
+     *
+     *  @param error set to the reason when the file can't be read or isn't a baseline
+     *  @return true if the file held at least one case, all with positive times
+     */
+    bool readBaseline(const std::string &path, std::map<std::string, double> &baseline, std::string &error) {
+        std::ifstream in(path.c_str());
+        if (!in) {
+            error = "no baseline at " + path + "; run with --write-baseline to record one";
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        if (in.bad()) {
+            error = "could not read baseline " + path;
+            return false;
+        }
+        const std::string text = buffer.str();
+        error = "baseline " + path + " is not a JSON object of case names and times";
+
+        size_t pos = 0;
+        skipSpace(text, pos);
+        if (pos == text.size() || text[pos++] != '{') return false;
+        for (;;) {
+            skipSpace(text, pos);
+            if (pos == text.size() || text[pos] != '"') return false;
+            const size_t close = text.find('"', pos + 1);
+            if (close == std::string::npos) return false;
+            const std::string name = text.substr(pos + 1, close - pos - 1);
+
+            pos = close + 1;
+            skipSpace(text, pos);
+            if (pos == text.size() || text[pos++] != ':') return false;
+            const char *start = text.c_str() + pos;
+            char *end = nullptr;
+            const double value = std::strtod(start, &end);
+            if (end == start || !(value > 0) || std::isinf(value)) return false;
+            baseline[name] = value;
+
+            pos = end - text.c_str();
+            skipSpace(text, pos);
+            if (pos == text.size()) return false;
+            if (text[pos] == ',') {
+                pos++;
+                continue;
+            }
+            if (text[pos++] != '}') return false;
+            break;
+        }
+        skipSpace(text, pos);
+        return pos == text.size();
+    }
+
+    bool writeBaseline(const std::string &path, const std::vector<Result> &results) {
+        std::ofstream out(path.c_str());
+        if (!out) return false;
+        out << "{\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            out << "    \"" << key(results[i]) << "\": " << results[i].nsPerItem;
+            out << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "}\n";
+        return (bool)out;
+    }
+
+    std::vector<unsigned> parseSizes(const char *text) {
+        std::vector<unsigned> sizes;
+        std::stringstream in(text);
+        std::string item;
+        while (std::getline(in, item, ',')) {
+            const unsigned size = (unsigned)std::strtoul(item.c_str(), nullptr, 10);
+            if (size > 0) sizes.push_back(size);
+        }
+        return sizes;
+    }
+
+    void usage() {
+        std::fprintf(stderr, "usage: tacoTruck-bench [--sizes 1000,10000,...] [--max-size N] [--repeats N]\n"
+                             "                       [--baseline FILE] [--threshold PERCENT] [--write-baseline]\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    unsigned maxSize = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--sizes") == 0 && hasValue) {
+            options.sizes = parseSizes(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max-size") == 0 && hasValue) {
+            maxSize = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--repeats") == 0 && hasValue) {
+            options.repeats = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--baseline") == 0 && hasValue) {
+            options.baseline = argv[++i];
+        } else if (std::strcmp(argv[i], "--threshold") == 0 && hasValue) {
+            const char *text = argv[++i];
+            char *end = nullptr;
+            const double percent = std::strtod(text, &end);
+            if (end == text || *end != '\0' || !(percent >= 0) || std::isinf(percent)) {
+                usage();
+                return 2;
+            }
+            options.threshold = percent / 100.0;
+        } else if (std::strcmp(argv[i], "--write-baseline") == 0) {
+            options.writeBaseline = true;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (maxSize > 0) {
+        options.sizes.erase(std::remove_if(options.sizes.begin(), options.sizes.end(),
+                                           [maxSize](unsigned size) { return size > maxSize; }),
+                            options.sizes.end());
+    }
+
+    std::vector<Result> results;
+    std::printf("%-28s %10s %14s %16s\n", "case", "particles", "ns/item/step", "Mitems/s");
+    for (size_t s = 0; s < options.sizes.size(); s++) {
+        const size_t first = results.size();
+        benchSize(options.sizes[s], options.repeats, results);
+        for (size_t i = first; i < results.size(); i++) {
+            std::printf("%-28s %10u %14.3f %16.2f\n", results[i].name.c_str(), results[i].size,
+                        results[i].nsPerItem, 1e3 / results[i].nsPerItem);
+        }
+        std::fflush(stdout);
+    }
+
+    if (options.writeBaseline) {
+        if (!writeBaseline(options.baseline, results)) {
+            std::fprintf(stderr, "could not write baseline %s\n", options.baseline.c_str());
+            return 2;
+        }
+        std::printf("\nwrote baseline %s\n", options.baseline.c_str());
+        return 0;
+    }
+
+    std::map<std::string, double> baseline;
+    std::string error;
+    if (!readBaseline(options.baseline, baseline, error)) {
+        std::fprintf(stderr, "\n%s\n", error.c_str());
+        return 2;
+    }
+
+    unsigned regressions = 0;
+    unsigned compared = 0;
+    std::set<std::string> measured;
+    std::printf("\ncomparing against %s (threshold %.1f%%)\n", options.baseline.c_str(), options.threshold * 100);
+    for (size_t i = 0; i < results.size(); i++) {
+        measured.insert(key(results[i]));
+        std::map<std::string, double>::const_iterator found = baseline.find(key(results[i]));
+        if (found == baseline.end()) {
+            std::printf("NEW        %-36s not in the baseline\n", key(results[i]).c_str());
+            continue;
+        }
+        compared++;
+        const double change = results[i].nsPerItem / found->second - 1;
+        if (change > options.threshold) {
+            std::printf("REGRESSION %-36s %10.3f -> %10.3f ns (%+.1f%%)\n", key(results[i]).c_str(),
+                        found->second, results[i].nsPerItem, change * 100);
+            regressions++;
+        }
+    }
+
+    // Cases left out of this run, say by --max-size, aren't failures, but shouldn't go unnoticed either.
+    for (std::map<std::string, double>::const_iterator i = baseline.begin(); i != baseline.end(); ++i) {
+        if (measured.count(i->first) == 0) std::printf("NOT RUN    %s\n", i->first.c_str());
+    }
+
+    if (compared == 0) {
+        std::fprintf(stderr, "no case matched the baseline, so nothing was compared\n");
+        return 2;
+    }
+    if (regressions > 0) {
+        std::printf("%u of %u case(s) regressed\n", regressions, compared);
+        return 1;
+    }
+    std::printf("no regressions in %u case(s)\n", compared);
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * A harness for the simulation driver, run against a simulated clock.
+ *
+ * The force generator here charges a fixed cost to a ManualClock each time it is applied, so the time each step
+ * takes is known exactly and the scenarios below are repeatable: a light load that fits in its budget, a heavy load
+ * that doesn't, and the same heavy load going away again. Each check prints a line, and the program exits with an
+ * error if any of them fail.
+ *
+ * Usage: tacoTruck-driver-harness
+ *
+ */
+#include <cmath>
+#include <cstdio>
+#include "particle.hpp"
+#include "pdriver.hpp"
+#include "pfgen.hpp"
+#include "plinks.hpp"
+
+using namespace tacoTruck;
+
+namespace {
+    /** The tick rate of the simulation and of the frames driving it. */
+    const real timestep = (real)(1.0 / 60.0);
+    const double frameTime = 1.0 / 60.0;
+
+    /** The time each frame may spend stepping. */
+    const double budget = 0.008;
+
+    /** Advances the clock by a set amount each time a force is applied, standing in for the real work. */
+    class ClockCharge : public ParticleForceGenerator {
+        ManualClock *clock;
+
+    public:
+        double cost;
+
+        ClockCharge(ManualClock *clock, double cost) : clock(clock), cost(cost) {}
+
+        ClockCharge(const ClockCharge&) = delete;
+        ClockCharge &operator=(const ClockCharge&) = delete;
+
+        virtual void updateForce(Particle *particle, real duration) {
+            clock->advance(cost);
+        }
+    };
+
+    unsigned failures = 0;
+
+    void check(bool passed, const char *what) {
+        std::printf("%s  %s\n", passed ? "pass" : "FAIL", what);
+        if (!passed) failures++;
+    }
+
+    /** Runs the given number of frames, each a frame's time after the previous one started. */
+    void runFrames(ParticleSimulationDriver &driver, ManualClock &clock, unsigned frames, bool *alphaInRange) {
+        for (unsigned f = 0; f < frames; f++) {
+            const double start = clock.now();
+            const real alpha = driver.frame();
+            if (alpha < 0 || alpha >= 1) *alphaInRange = false;
+
+            // Whatever the stepping cost, the next frame starts a frame's time after this one, or straight away if
+            // the stepping took longer than that.
+            const double spent = clock.now() - start;
+            if (spent < frameTime) clock.advance(frameTime - spent);
+        }
+    }
+}
+
+int main() {
+    ManualClock clock;
+    ParticleForceRegistry registry;
+
+    // A short chain of particles falling under gravity, held together by rods.
+    Particle particles[4];
+    ParticleLinkSolver links;
+    for (unsigned i = 0; i < 4; i++) {
+        particles[i].setMass(1);
+        particles[i].setDamping(1);
+        particles[i].setPosition(Vector2D((real)i, 0));
+        links.add(&particles[i]);
+    }
+    for (unsigned i = 0; i + 1 < 4; i++) links.add(ParticleRod{i, i + 1, 1});
+
+    ParticleGravity gravity(Vector2D(0, -10));
+    ClockCharge charge(&clock, 0.0001);
+    for (unsigned i = 0; i < 4; i++) registry.add(&particles[i], &gravity);
+    registry.add(&particles[0], &charge);
+
+    ParticleSimulationDriver driver(&clock, &registry, timestep, budget);
+    for (unsigned i = 0; i < 4; i++) driver.add(&particles[i]);
+    driver.setSubsteps(4, 1);
+    driver.setLinkSolver(&links, 8, 1);
+
+    // A light load: every step is taken at full quality, with no overruns.
+    bool alphaInRange = true;
+    runFrames(driver, clock, 1 + 600, &alphaInRange);
+    const ParticleSimulationDriver::Statistics &stats = driver.getStatistics();
+    check(stats.overrunFrames == 0, "light load: no frames over budget");
+    check(stats.droppedSteps == 0, "light load: no steps dropped");
+    check(stats.steps >= 599 && stats.steps <= 601, "light load: one step per frame");
+    check(stats.substeps == 4 && stats.iterations == 8, "light load: full quality kept");
+    check(alphaInRange, "light load: interpolation fraction within [0, 1)");
+
+    // The chain is falling, so the interpolated position should lie above the current one, by no more than a step.
+    const real current = particles[0].getPosition().y;
+    const real interpolated = driver.getInterpolatedPosition(0).y;
+    const real stepDistance = (std::fabs(particles[0].getVelocity().y) + 10 * timestep) * timestep;
+    check(interpolated >= current && interpolated <= current + stepDistance,
+          "light load: interpolated position lies within the last step");
+
+    // A heavy load: each substep now costs more than a whole frame's budget, so the driver has to drop time and
+    // reduce its quality, but the number of steps per frame stays bounded.
+    driver.resetStatistics();
+    charge.cost = 0.01;
+    alphaInRange = true;
+    runFrames(driver, clock, 120, &alphaInRange);
+    check(stats.overrunFrames > 0, "heavy load: overruns reported");
+    check(stats.droppedSteps > 0, "heavy load: steps dropped instead of piling up");
+    check(stats.steps <= stats.frames, "heavy load: at most one step per frame");
+    check(stats.substeps == 1 && stats.iterations == 1, "heavy load: quality reduced to the minimum");
+    check(stats.maxFrameWork <= 4 * 0.01 + 1e-9, "heavy load: no frame does more than one full step");
+    check(alphaInRange, "heavy load: interpolation fraction within [0, 1)");
+
+    // The load goes away again: the frames fit in the budget and the quality comes back.
+    driver.resetStatistics();
+    charge.cost = 0.0001;
+    alphaInRange = true;
+    runFrames(driver, clock, 600, &alphaInRange);
+    check(stats.substeps == 4 && stats.iterations == 8, "recovery: full quality restored");
+    check(stats.lastFrameWork <= budget, "recovery: last frame within budget");
+    check(alphaInRange, "recovery: interpolation fraction within [0, 1)");
+
+    // The rods still hold the chain together.
+    const real length = (particles[1].getPosition() - particles[0].getPosition()).magnitude();
+    check(std::fabs(length - 1) < (real)0.05, "the rods still hold");
+
+    std::printf("%u failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
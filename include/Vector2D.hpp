@@ -46,7 +46,7 @@
 		/** Turns a non-zero vector into a vector of unit length. */
 		void normalize() {
 			real mag = magnitude();
-			if ( mag < 0 ) {
+			if ( mag > 0 ) {
 				(*this) *= ((real)1)/mag;
 			}
 		}
@@ -0,0 +1,68 @@
+#ifndef PHYSICS_PARALLEL_HPP_
+#define PHYSICS_PARALLEL_HPP_
+/*
+ * A small pool of persistent worker threads used to split loops over particles (or worlds, links, queries...) across
+ * the available cores. The threads are created once and wait between jobs, so handing out a job costs a wake-up rather
+ * than a thread creation.
+ *
+ */
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tacoTruck {
+class WorkerPool {
+public:
+    /** A job processes the items in the range [begin, end). */
+    typedef std::function<void(unsigned begin, unsigned end)> Task;
+
+protected:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::mutex runMutex;                /**< Serialises calls to run from different threads. */
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const Task *task;                   /**< The job being processed. */
+    unsigned count;                     /**< The number of items in the job. */
+    unsigned grain;                     /**< The number of items handed out at once. */
+    std::atomic<unsigned> next;         /**< The first item not yet handed out. */
+    unsigned busy;                      /**< The number of workers still processing the job. */
+    unsigned generation;                /**< Incremented for every job, so the workers can tell a new one arrived. */
+    bool stopping;
+
+    /** The main loop of each worker thread. */
+    void work();
+
+    /** Claims and processes ranges of the current job until none are left. */
+    void process();
+
+public:
+    /**
+     *  Creates a pool.
+     *
+     *  @param threadCount the total number of threads to use, including the thread calling run. Zero uses one per core.
+     */
+    explicit WorkerPool(unsigned threadCount = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool &operator=(const WorkerPool&) = delete;
+
+    /** Returns the total number of threads that process a job, including the thread calling run. */
+    unsigned getThreadCount() const;
+
+    /**
+     *  Processes the items [0, count) in ranges of at most grain items, spread across the pool, and returns when they
+     *  are all done. The calling thread takes part. Tasks must not call run themselves.
+     */
+    void run(unsigned count, unsigned grain, const Task &task);
+
+    /** Returns a pool shared by the whole engine, with one thread per core. */
+    static WorkerPool &getDefault();
+};
+}   // namespace tacoTruck
+#endif // PHYSICS_PARALLEL_HPP_
@@ -21,6 +21,14 @@ protected:
     Vector2D velocity;
     Vector2D acceleration;
     Vector2D forceAccum;
+#ifdef PREC_MIXED
+    int cellX;                      /**< The grid cell the position is relative to. */
+    int cellY;
+    Vector2D forceCompensation;     /**< The low-order part lost from forceAccum by rounding. */
+
+    /** Moves the position into the range [0, POSITION_CELL_SIZE) by changing cells. */
+    void rebaseCell();
+#endif
 public:
     /** Creates a new Particle with default parameters. */
     Particle();
@@ -50,6 +58,22 @@ public:
     void setPosition(const real x, const real y);
     void getPosition(Vector2D* position) const;
     Vector2D getPosition() const;
+
+    /**
+     *  Sets and gets the position at double precision. When compiled with PREC_MIXED, this keeps the full precision
+     *  of the stored position; otherwise it is the same as the single-precision accessors.
+     */
+    void setWorldPosition(const double x, const double y);
+    void getWorldPosition(double* x, double* y) const;
+
+    /**
+     *  Returns the position of this particle relative to the given particle. Force generators that act between two
+     *  particles should use this rather than subtracting their positions, which loses precision far from the origin.
+     */
+    Vector2D getOffsetFrom(const Particle& other) const;
+
+    /** Moves the particle by the given offset. */
+    void translate(const Vector2D& offset);
     void setVelocity(const Vector2D& velocity);
     void setVelocity(const real x, const real y);
     void getVelocity(Vector2D* velocity) const;
@@ -73,6 +97,10 @@ public:
      *  @param force a force to be applied to this particle at the next integration step
      */
     void addForce(const Vector2D& force);
+
+    /** Gets the total force accumulated since the last integration step. */
+    void getAccumulatedForce(Vector2D* force) const;
+    Vector2D getAccumulatedForce() const;
 };	// Particle
 }	// namespace tacoTruck
 
@@ -0,0 +1,139 @@
+#ifndef PHYSICS_PBATCH_HPP_
+#define PHYSICS_PBATCH_HPP_
+/*
+ * A batch of many small, independent particle worlds stepped together. This is meant for sweeps over thousands of
+ * scenarios with tens to hundreds of particles each, where running a ParticleForceRegistry per world would spend most
+ * of its time on virtual calls and pointer chasing.
+ *
+ * The particles of all worlds are packed into shared structure-of-arrays buffers, world after world, and the force
+ * generators are limited to the common types, stored as plain parameters. Each world is padded to a whole number of
+ * blocks of lanes, and its parameters are copied out to every particle, so the force and integration loops run over
+ * the particles of several worlds at once in fixed size blocks without branches, which the compiler vectorises. The
+ * worlds are spread across the worker pool in chunks. Worlds never interact, so each chunk runs all of its steps
+ * without waiting for the others.
+ *
+ * Positions are stored relative to the first particle added to each world, so worlds far from the origin keep their
+ * precision under PREC_MIXED.
+ *
+ * The force generators behave as ParticleGravity, ParticleDrag, ParticleAttraction and ParticleSpring do, so a
+ * world gives the same result here as through a ParticleForceRegistry, up to rounding. This includes the spring
+ * pulling its ends together when compressed as well as when stretched, as ParticleSpring does.
+ *
+ */
+#include <vector>
+#include "Vector2D.hpp"
+#include "particle.hpp"
+#include "parallel.hpp"
+
+namespace tacoTruck {
+class ParticleWorldBatch {
+protected:
+    /** Holds the ranges of one world in the shared buffers, and the parameters of its force generators. */
+    struct World {
+        unsigned firstParticle;
+        unsigned particleCount;     /**< The number of particles added; the world's slots are padded past this. */
+        unsigned firstSpring;
+        unsigned springCount;
+        Vector2D gravity;           /**< As ParticleGravity. */
+        real dragK1;                /**< As ParticleDrag. */
+        real dragK2;
+        real attractionMagnitude;   /**< As ParticleAttraction. Zero disables the attraction. */
+        Vector2D attractionOrigin;
+        double originX;             /**< The world position the world's particle positions are relative to. */
+        double originY;
+
+        World() : firstParticle(0), particleCount(0), firstSpring(0), springCount(0), gravity(),
+                  dragK1(0), dragK2(0), attractionMagnitude(0), attractionOrigin(), originX(0), originY(0) {}
+    };
+    std::vector<World> worlds;
+
+    /** Particle state, one entry per particle across all worlds. Positions are relative to the world's origin. */
+    std::vector<real> positionX;
+    std::vector<real> positionY;
+    std::vector<real> velocityX;
+    std::vector<real> velocityY;
+    std::vector<real> accelerationX;
+    std::vector<real> accelerationY;
+    std::vector<real> inverseMass;
+    std::vector<real> damping;
+    std::vector<real> moving;       /**< One for particles with finite mass, zero for the others and for padding. */
+
+    /** The force generator parameters of each particle's world. */
+    std::vector<real> gravityX;
+    std::vector<real> gravityY;
+    std::vector<real> dragK1;
+    std::vector<real> dragK2;
+    std::vector<real> attraction;
+    std::vector<real> attractionX;  /**< Relative to the world's origin. */
+    std::vector<real> attractionY;
+
+    /** Acceleration accumulated from the force generators during a step. */
+    std::vector<real> accumX;
+    std::vector<real> accumY;
+
+    /** Springs between particles of the same world, indexed into the particle buffers. */
+    std::vector<unsigned> springA;
+    std::vector<unsigned> springB;
+    std::vector<real> springConstant;
+    std::vector<real> springRestLength;
+
+    /** Scratch holding damping^duration for each particle during a run. */
+    std::vector<real> dampingFactor;
+
+    /** Appends a block of padding particles to the given world, which must be the last. */
+    void addBlock(const World &world);
+
+    /** Copies the parameters of the given world out to all of its particles. */
+    void setParameters(const World &world);
+
+    /** Returns the index just past the last slot of the given world, including its padding. */
+    unsigned endOf(const World &world) const;
+
+    /** Steps the consecutive worlds [begin, end) forward by the given duration. */
+    void stepWorlds(unsigned begin, unsigned end, real duration);
+
+public:
+    ParticleWorldBatch();
+
+    /** Adds a new, empty world and returns its index. Particles and springs can only be added to the last world. */
+    unsigned addWorld();
+
+    /** Adds a copy of the given particle's state to the given world and returns its index within the world. */
+    unsigned addParticle(unsigned world, const Particle &particle);
+
+    /**
+     *  Adds a spring between two particles of the given world, applying equal and opposite forces to both ends.
+     *
+     *  @param a the index of the first particle within the world
+     *  @param b the index of the second particle within the world
+     */
+    void addSpring(unsigned world, unsigned a, unsigned b, real springConstant, real restLength);
+
+    void setGravity(unsigned world, const Vector2D &gravity);
+    void setDrag(unsigned world, real k1, real k2);
+    void setAttraction(unsigned world, real magnitude, const Vector2D &origin);
+
+    /** Removes all the worlds. */
+    void clear();
+
+    unsigned getWorldCount() const;
+    unsigned getParticleCount(unsigned world) const;
+
+    /**
+     *  Steps every world forward the given number of times.
+     *
+     *  @param duration the amount of time (in seconds) to simulate per step
+     *  @param steps the number of steps to take
+     *  @param pool the threads to spread the worlds across
+     */
+    void run(real duration, unsigned steps, WorkerPool &pool = WorkerPool::getDefault());
+
+    /** Returns the state of a particle, given its index within its world. */
+    Vector2D getPosition(unsigned world, unsigned index) const;
+    Vector2D getVelocity(unsigned world, unsigned index) const;
+
+    /** Copies the position and velocity of a particle back into the given particle. */
+    void getParticle(unsigned world, unsigned index, Particle *particle) const;
+};
+}   // namespace tacoTruck
+#endif // PHYSICS_PBATCH_HPP_
@@ -0,0 +1,106 @@
+#ifndef PHYSICS_PCOLLIDE_HPP_
+#define PHYSICS_PCOLLIDE_HPP_
+/*
+ * Collision between particles and static level geometry made of line segments and planes.
+ *
+ * The segments are built once into a bounding volume hierarchy, stored as a flat array of nodes in depth-first order
+ * so that a query walks forwards through memory. Particles are tested along the whole path they moved during a step
+ * (from their position before Particle::integrate to their position after it), so fast particles cannot tunnel
+ * through thin geometry.
+ *
+ */
+#include <vector>
+#include "Vector2D.hpp"
+#include "particle.hpp"
+#include "parallel.hpp"
+
+namespace tacoTruck {
+/** Describes the first point where a particle's path meets the static geometry. */
+struct ParticleStaticContact {
+    unsigned particle;  /**< The index of the particle in the array passed to detect. */
+    unsigned feature;   /**< The index of the segment or plane that was hit, in the order they were added. */
+    bool plane;         /**< True if the feature is a plane, false if it is a segment. */
+    real time;          /**< How far along the path the contact happens, from 0 (start) to 1 (end). */
+    Vector2D point;     /**< The point of contact. */
+    Vector2D normal;    /**< The unit normal of the surface, facing the side the particle came from. */
+    double offset;      /**< The surface is the line where position * normal == offset. */
+};
+
+class StaticCollisionWorld {
+protected:
+    /** A node of the hierarchy. The left child of an internal node always follows it directly. */
+    struct Node {
+        Vector2D min;
+        Vector2D max;
+        unsigned index;     /**< For a leaf the first segment, otherwise the right child. */
+        unsigned count;     /**< For a leaf the number of segments, otherwise zero. */
+
+        Node() : min(), max(), index(0), count(0) {}
+    };
+    std::vector<Node> nodes;
+
+    /** The segments, reordered by the build so that each leaf's segments are contiguous. */
+    std::vector<Vector2D> segmentStart;
+    std::vector<Vector2D> segmentEnd;
+    std::vector<unsigned> segmentId;
+
+    /** Planes are few and unbounded, so they are kept outside the hierarchy. */
+    std::vector<Vector2D> planeNormal;
+    std::vector<real> planeOffset;
+
+    bool built;
+
+    /** Builds the subtree over the segments [begin, end) and returns the index of its root node. */
+    unsigned buildNode(unsigned begin, unsigned end, std::vector<Vector2D> &centre);
+
+public:
+    StaticCollisionWorld();
+
+    /** Adds a line segment between the two given points and returns its index. */
+    unsigned addSegment(const Vector2D &start, const Vector2D &end);
+
+    /**
+     *  Adds a plane and returns its index. The space where position * normal < offset is solid.
+     *
+     *  @param normal the unit normal of the plane, pointing out of the solid side
+     *  @param offset the distance of the plane from the origin along the normal
+     */
+    unsigned addPlane(const Vector2D &normal, real offset);
+
+    /** Removes all the geometry. */
+    void clear();
+
+    /** Builds the hierarchy. This must be called after the geometry is added and before any query. */
+    void build();
+
+    /**
+     *  Finds the first point where the path from one position to another meets the geometry.
+     *
+     *  @return true if there was a contact, in which case the contact is filled in (apart from its particle index)
+     */
+    bool sweep(const Vector2D &from, const Vector2D &to, ParticleStaticContact *contact) const;
+
+    /**
+     *  Sweeps each particle from its previous position to its current one, in parallel, and writes a contact for each
+     *  particle whose path meets the geometry. Nothing is allocated.
+     *
+     *  @param particles the particles to test
+     *  @param previousPositions the position of each particle before it was last integrated
+     *  @param count the number of particles
+     *  @param contacts storage for the contacts, with room for count entries
+     *  @return the number of contacts written to the start of the contacts array
+     */
+    unsigned detect(Particle *const *particles, const Vector2D *previousPositions, unsigned count,
+                    ParticleStaticContact *contacts, WorkerPool &pool = WorkerPool::getDefault()) const;
+
+    /**
+     *  Moves the particle back to the point of contact, just clear of the surface, and removes its velocity into the
+     *  surface, reflecting it by the given coefficient of restitution. The distance from the surface is worked out at
+     *  double precision, so under PREC_MIXED the particle ends up clear of the surface even where the contact point
+     *  itself, held as a real, is less precise than the clearance.
+     */
+    static void resolve(Particle *particle, const ParticleStaticContact &contact, real restitution,
+                        real clearance = (real)0.001);
+};
+}   // namespace tacoTruck
+#endif // PHYSICS_PCOLLIDE_HPP_
@@ -0,0 +1,139 @@
+#ifndef PHYSICS_PDRIVER_HPP_
+#define PHYSICS_PDRIVER_HPP_
+/*
+ * A driver for running the simulation continuously at a fixed tick rate.
+ *
+ * Each frame, the driver adds the real time that passed to an accumulator and takes as many fixed steps as the
+ * accumulator holds, leaving the remainder for the next frame. Positions for rendering are interpolated between the
+ * last two steps by the fraction of a step left over.
+ *
+ * The stepping work in each frame is limited to a time budget. When the budget runs out, the rest of the accumulated
+ * time is dropped rather than carried over, so a slow frame can't cause an ever-growing backlog of steps. Frames that
+ * go over budget also lower the quality of the following steps, first by reducing the link solver's iterations and
+ * then the number of substeps; once frames are comfortably within budget again, the quality is raised back.
+ *
+ */
+#include <vector>
+#include "Vector2D.hpp"
+#include "particle.hpp"
+#include "pfgen.hpp"
+#include "plinks.hpp"
+
+namespace tacoTruck {
+/** A source of time for the driver, in seconds. */
+class SimulationClock {
+public:
+    virtual double now() = 0;
+    virtual ~SimulationClock() {}
+};
+
+/** A clock that reads the system's monotonic clock. */
+class SteadyClock : public SimulationClock {
+public:
+    virtual double now();
+};
+
+/** A clock that only moves when told to, for driving the simulation in tests and tools. */
+class ManualClock : public SimulationClock {
+    double time;
+
+public:
+    ManualClock();
+    virtual double now();
+
+    /** Moves the clock forward by the given number of seconds. */
+    void advance(double seconds);
+};
+
+class ParticleSimulationDriver {
+public:
+    /** Holds statistics about the frames run so far. */
+    struct Statistics {
+        unsigned long frames;           /**< The number of frames run. */
+        unsigned long steps;            /**< The number of fixed steps taken. */
+        unsigned long overrunFrames;    /**< The number of frames that went over budget. */
+        unsigned long droppedSteps;     /**< The number of steps skipped to stay within budget. */
+        double lastFrameWork;           /**< The time spent stepping in the last frame. */
+        double maxFrameWork;            /**< The longest time spent stepping in any frame. */
+        unsigned substeps;              /**< The number of substeps currently taken per step. */
+        unsigned iterations;            /**< The number of link solver iterations currently used per substep. */
+    };
+
+protected:
+    SimulationClock *clock;
+    ParticleForceRegistry *registry;
+    ParticleLinkSolver *links;
+    std::vector<Particle*> particles;
+    std::vector<Vector2D> previousPosition;  /**< The position of each particle before the last step. */
+
+    real timestep;                  /**< The duration of each fixed step. */
+    double budget;                  /**< The time that may be spent stepping each frame. */
+    double accumulator;             /**< The simulated time owed that hasn't been stepped yet. */
+    double lastTime;
+    bool started;
+
+    unsigned maxSubsteps;
+    unsigned minSubsteps;
+    unsigned maxIterations;
+    unsigned minIterations;
+    unsigned maxStepsPerFrame;
+    unsigned calmFrames;            /**< The number of frames in a row that were well within budget. */
+
+    Statistics statistics;
+
+    /** Takes one fixed step at the current quality. */
+    void step();
+
+    /** Lowers or raises the quality of the following steps, given how the last frame went. */
+    void adjustQuality(bool overrun, double work);
+
+public:
+    /**
+     *  Creates a driver.
+     *
+     *  @param clock the clock to measure frames and work by
+     *  @param registry the registry that calculates the forces on the particles
+     *  @param timestep the duration (in seconds) of each fixed step
+     *  @param budget the time (in seconds) that may be spent stepping in each frame
+     */
+    ParticleSimulationDriver(SimulationClock *clock, ParticleForceRegistry *registry, real timestep, double budget);
+
+    ParticleSimulationDriver(const ParticleSimulationDriver&) = delete;
+    ParticleSimulationDriver &operator=(const ParticleSimulationDriver&) = delete;
+
+    /** Adds the given particle to the set being stepped. */
+    void add(Particle *particle);
+
+    /** Removes all the particles. The particles themselves are not deleted. */
+    void clear();
+
+    /**
+     *  Sets a link solver to run after each substep, with the number of iterations to use at full quality and the
+     *  least it may be reduced to.
+     */
+    void setLinkSolver(ParticleLinkSolver *links, unsigned iterations, unsigned minIterations);
+
+    /** Sets the number of substeps each step is divided into at full quality, and the least it may be reduced to. */
+    void setSubsteps(unsigned substeps, unsigned minSubsteps);
+
+    /** Sets the most steps that may be taken in one frame, however much time has accumulated. */
+    void setMaxStepsPerFrame(unsigned steps);
+
+    /**
+     *  Reads the clock and takes the steps that are due. Call this once per frame.
+     *
+     *  @return the fraction of a step left over, for interpolating the positions
+     */
+    real frame();
+
+    /** Returns the fraction of a step left over after the last frame. */
+    real getAlpha() const;
+
+    /** Returns the position of a particle interpolated between the last two steps, for rendering. */
+    Vector2D getInterpolatedPosition(unsigned index) const;
+
+    const Statistics &getStatistics() const;
+    void resetStatistics();
+};
+}   // namespace tacoTruck
+#endif // PHYSICS_PDRIVER_HPP_
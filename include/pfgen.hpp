@@ -36,9 +36,14 @@ protected:
     Registry registrations;
 
 public:
+    ParticleForceRegistry();
+
     /** Registers the given force generator to apply to the given particle. */
     void add(Particle *particle, ParticleForceGenerator *fg);
 
+    /** Registers each of the given force generators to apply to the corresponding particle, in one go. */
+    void add(Particle *const *particles, ParticleForceGenerator *const *fgs, unsigned count);
+
     /** Removes the given registered pair from the registry.
      *  If the pair is not registered, this method will have no effect.
      */
@@ -0,0 +1,87 @@
+#ifndef PHYSICS_PFIELD_HPP_
+#define PHYSICS_PFIELD_HPP_
+/*
+ * A force generator for smooth long range fields made by many attracting or repelling sources.
+ *
+ * Applying M ParticleAttraction-style sources to N particles directly costs N * M evaluations per step. Instead, the
+ * sources are spread onto a square grid, the potential they create is found once per step by solving Poisson's
+ * equation with a multigrid solver, and each particle then only samples the resulting field, so a step costs about
+ * N + (grid size).
+ *
+ * The potential is held at zero on the edges of the grid, so the grid should extend well past the sources and the
+ * particles. Particles outside the grid feel no force.
+ *
+ */
+#include <vector>
+#include "Vector2D.hpp"
+#include "particle.hpp"
+#include "pfgen.hpp"
+
+namespace tacoTruck {
+class ParticlePotentialField : public ParticleForceGenerator {
+protected:
+    /** The sources, as positions and strengths. */
+    std::vector<Vector2D> sourcePosition;
+    std::vector<real> sourceStrength;
+
+    Vector2D origin;        /**< The position of the grid's first corner. */
+    real cellSize;          /**< The distance between neighbouring grid points. */
+    unsigned levels;        /**< The number of multigrid levels; the finest grid has 2^levels + 1 points a side. */
+
+    /** The potential and right-hand side on each level, finest last. */
+    std::vector<std::vector<real> > potential;
+    std::vector<std::vector<real> > density;
+    std::vector<real> residual;
+
+    /** The acceleration at each point of the finest grid. */
+    std::vector<real> fieldX;
+    std::vector<real> fieldY;
+
+    /** Returns the number of points along a side of the grid on the given level. */
+    unsigned sideOf(unsigned level) const;
+
+    /** Performs red-black Gauss-Seidel sweeps on the given level. */
+    void smooth(unsigned level, unsigned sweeps);
+
+    /** Performs one multigrid V-cycle on the given level. */
+    void cycle(unsigned level);
+
+public:
+    /**
+     *  Creates a field covering a square grid.
+     *
+     *  @param origin the position of the corner of the grid with the smallest coordinates
+     *  @param cellSize the distance between grid points
+     *  @param resolution the grid has 2^resolution + 1 points along each side
+     */
+    ParticlePotentialField(const Vector2D &origin, real cellSize, unsigned resolution);
+
+    /**
+     *  Adds a source to the field. A source pulls particles towards it with an acceleration of strength / distance,
+     *  as gravity does in two dimensions; a negative strength pushes them away instead.
+     */
+    void addSource(const Vector2D &position, real strength);
+
+    /** Removes all the sources. */
+    void clearSources();
+
+    /** Moves the given source. */
+    void setSourcePosition(unsigned index, const Vector2D &position);
+
+    /**
+     *  Spreads the sources onto the grid and solves for the field. Call this once per step, after moving the sources
+     *  and before the forces are updated. The previous solution is used as the starting point, so when the sources
+     *  move a little each step one or two cycles are usually enough.
+     *
+     *  @param cycles the number of multigrid V-cycles to perform
+     */
+    void solve(unsigned cycles = 2);
+
+    /** Returns the acceleration due to the field at the given position. */
+    Vector2D sample(const Vector2D &position) const;
+
+    /** Applies the force of the field to the given particle. */
+    virtual void updateForce(Particle *particle, real duration);
+};
+}   // namespace tacoTruck
+#endif // PHYSICS_PFIELD_HPP_
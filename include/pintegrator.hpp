@@ -0,0 +1,168 @@
+#ifndef PHYSICS_PINTEGRATOR_HPP_
+#define PHYSICS_PINTEGRATOR_HPP_
+/*
+ * Integrators that advance groups of particles together, as an alternative to calling Particle::integrate on each
+ * particle with a fixed duration. Forces are still computed by a ParticleForceRegistry.
+ *
+ */
+#include <vector>
+#include "Vector2D.hpp"
+#include "particle.hpp"
+#include "pfgen.hpp"
+
+namespace tacoTruck {
+/**
+ *  Integrates a set of particles with an embedded Runge-Kutta pair (Bogacki-Shampine 3(2)), choosing the step size
+ *  automatically so that the estimated error of each step stays within the tolerance.
+ *
+ *  The forces are evaluated through the given registry several times per step, so every particle that has force
+ *  registrations in the registry should also be added to the integrator. Damping is treated as a continuous drag so
+ *  that the result matches Particle::integrate for small steps.
+ */
+class ParticleAdaptiveIntegrator {
+public:
+    /** Holds statistics about the most recent call to integrate. */
+    struct StepReport {
+        real stepSize;          /**< The step size chosen by the controller for the next step. */
+        real lastStep;          /**< The last accepted step, which may have been shortened to end on time. */
+        unsigned acceptedSteps; /**< The number of steps taken to cover the duration. */
+        unsigned rejectedSteps; /**< The number of steps that were retried with a smaller step size. */
+    };
+
+protected:
+    ParticleForceRegistry *registry;    /**< The registry used to evaluate the forces. */
+    std::vector<Particle*> particles;   /**< The particles being integrated. */
+    real tolerance;                     /**< The largest error allowed per step. */
+    real minStep;                       /**< Steps this small are always accepted. */
+    real maxStep;                       /**< The largest step the integrator will take. */
+    real stepSize;                      /**< The step size to try next. */
+    StepReport report;
+
+    /**
+     *  Scratch storage, reused between steps to avoid allocating. The start positions are held at double precision
+     *  and each stage is set through Particle::setWorldPosition, so particles far from the origin keep moving under
+     *  PREC_MIXED.
+     */
+    std::vector<double> startX;
+    std::vector<double> startY;
+    std::vector<Vector2D> startVelocity;
+    std::vector<Vector2D> dPosition[4];
+    std::vector<Vector2D> dVelocity[4];
+
+    /** Evaluates the derivatives of all particles in their current state into the given stage. */
+    void evaluate(unsigned stage, real duration);
+
+    /** Moves the particles to the start state offset by the weighted sum of the given stages. */
+    void setStageState(real duration, const real *weights, unsigned stages);
+
+public:
+    /**
+     *  Creates a new integrator.
+     *
+     *  @param registry the registry that calculates the forces on the particles
+     *  @param tolerance the largest error allowed per step, relative to the distance moved over the step (for
+     *  positions) or the speed (for velocities), plus one
+     *  @param minStep the smallest step size that may be taken
+     *  @param maxStep the largest step size that may be taken
+     */
+    ParticleAdaptiveIntegrator(ParticleForceRegistry *registry, real tolerance, real minStep, real maxStep);
+
+    ParticleAdaptiveIntegrator(const ParticleAdaptiveIntegrator&) = delete;
+    ParticleAdaptiveIntegrator &operator=(const ParticleAdaptiveIntegrator&) = delete;
+
+    /** Adds the given particle to the set being integrated. */
+    void add(Particle *particle);
+
+    /** Removes the given particle. If the particle is not present, this method will have no effect. */
+    void remove(Particle *particle);
+
+    /** Removes all the particles. The particles themselves are not deleted. */
+    void clear();
+
+    /**
+     *  Integrates all the particles forward in time by exactly the given amount, taking as many steps as needed.
+     *
+     *  @param duration the amount of time (in seconds) to simulate
+     *  @return the step size chosen and the number of accepted and rejected steps
+     */
+    const StepReport &integrate(real duration);
+
+    /** Returns the statistics of the most recent call to integrate. */
+    const StepReport &getReport() const;
+
+    /** Returns the step size the integrator will try first on the next call to integrate. */
+    real getStepSize() const;
+    void setStepSize(const real stepSize);
+    void setTolerance(const real tolerance);
+    real getTolerance() const;
+};
+
+/**
+ *  Integrates particles at different rates. Each particle belongs to a rate class; class k takes one step for every
+ *  2^k base steps, so slow moving particles can be placed in a high class and cost a fraction of the work.
+ *
+ *  Each class has its own force registry, which is only updated when that class takes a step. The registrations for
+ *  a particle must be added to the registry of the particle's class. A slow particle that the generators of a faster
+ *  class read, such as the other end of a spring, should be added as presented: between its steps it is shown at a
+ *  position and velocity interpolated between the start and end of its step, so forces between particles in
+ *  different classes stay smooth. Other slow particles simply hold the state at the end of their current step, so
+ *  they cost nothing between their steps.
+ */
+class ParticleMultiRateIntegrator {
+protected:
+    /**
+     *  Holds the particles of one rate class, and the state at either end of their current step for the presented
+     *  ones. Positions are held at double precision, so particles far from the origin keep moving under PREC_MIXED.
+     */
+    struct RateClass {
+        std::vector<Particle*> particles;   /**< The presented particles come first. */
+        unsigned presented;                 /**< The number of particles interpolated between the class's steps. */
+        std::vector<double> startX;
+        std::vector<double> startY;
+        std::vector<double> endX;
+        std::vector<double> endY;
+        std::vector<Vector2D> startVelocity;
+        std::vector<Vector2D> endVelocity;
+        ParticleForceRegistry registry;
+
+        RateClass() : particles(), presented(0), startX(), startY(), endX(), endY(), startVelocity(), endVelocity(),
+                      registry() {}
+    };
+
+    std::vector<RateClass> classes;
+    unsigned substep;   /**< The number of base steps taken within the step of the slowest class. */
+
+public:
+    /** Creates an integrator with the given number of rate classes. Class 0 steps at the base rate. */
+    ParticleMultiRateIntegrator(unsigned rateClasses);
+
+    /**
+     *  Adds the given particle to the given rate class.
+     *
+     *  @param presented whether generators in faster classes read the particle, so it has to be interpolated between
+     *  the steps of its class
+     */
+    void add(Particle *particle, unsigned rateClass, bool presented = false);
+
+    /** Removes the given particle. If the particle is not present, this method will have no effect. */
+    void remove(Particle *particle);
+
+    /** Removes all the particles and registrations. The particles themselves are not deleted. */
+    void clear();
+
+    /** Returns the registry holding the force registrations for the particles of the given rate class. */
+    ParticleForceRegistry &getRegistry(unsigned rateClass);
+
+    /** Returns the number of rate classes. */
+    unsigned getRateClasses() const;
+
+    /**
+     *  Advances the simulation by one base step. Only the classes whose step begins now are integrated, each by its
+     *  own duration of 2^k times the base step.
+     *
+     *  @param duration the base step (in seconds)
+     */
+    void integrate(real duration);
+};
+}   // namespace tacoTruck
+#endif // PHYSICS_PINTEGRATOR_HPP_
@@ -0,0 +1,110 @@
+#ifndef PHYSICS_PKDTREE_HPP_
+#define PHYSICS_PKDTREE_HPP_
+/*
+ * A k-d tree over particle positions for nearest neighbour, k nearest neighbour and radius queries.
+ *
+ * The tree is meant to be rebuilt every frame. It is stored as a single flat array with an implicit layout: the node
+ * for a range of the array sits at the middle of the range, its left subtree fills the first half and its right
+ * subtree the second. Each node also keeps the bounding box of its subtree, which the queries use for pruning. When
+ * only a few particles moved, the boxes can be refitted around the new positions instead of rebuilding; the tree stays
+ * correct, only less balanced.
+ *
+ */
+#include <vector>
+#include "Vector2D.hpp"
+#include "particle.hpp"
+#include "parallel.hpp"
+
+namespace tacoTruck {
+class ParticleKdTree {
+protected:
+    struct Node {
+        Vector2D point;     /**< The position of the particle at this node. */
+        Vector2D min;       /**< The bounding box of the subtree. */
+        Vector2D max;
+        unsigned id;        /**< The index of the particle in the array the tree was built from. */
+        unsigned left;      /**< The position of the left child, or the node count if there is none. */
+        unsigned right;     /**< The position of the right child, or the node count if there is none. */
+        unsigned parent;    /**< The position of the parent node, or the node count for the root. */
+        bool splitX;        /**< True if the subtree is split along x, false for y. */
+
+        Node() : point(), min(), max(), id(0), left(0), right(0), parent(0), splitX(true) {}
+    };
+    std::vector<Node> nodes;
+
+    /** The position in the tree of each particle, by particle index. */
+    std::vector<unsigned> slot;
+
+    /** Chooses the split of the range [begin, end), partitions it around the middle and links the children. */
+    void split(unsigned begin, unsigned end);
+
+    /** Builds the subtree over [begin, end) completely. */
+    void buildRange(unsigned begin, unsigned end);
+
+    /** Splits the top levels of the tree, collecting the ranges below them to be built in parallel. */
+    void buildTop(unsigned begin, unsigned end, unsigned depth, std::vector<unsigned> &ranges);
+
+    /** Calculates the boxes of the top levels once the subtrees below them are built. */
+    void finishTop(unsigned begin, unsigned end, unsigned depth);
+
+    /** Calculates the box of the node for [begin, end) from its point and its children's boxes. */
+    void fitNode(unsigned begin, unsigned end);
+
+    /** Recalculates the box of the node at the given position from its point and its children. */
+    bool refitNode(unsigned position);
+
+    void nearestRange(unsigned begin, unsigned end, const Vector2D &point, unsigned k, unsigned &found,
+                      unsigned *indices, real *squareDistances) const;
+
+    void radiusRange(unsigned begin, unsigned end, const Vector2D &point, real squareRadius,
+                     std::vector<unsigned> &result) const;
+
+public:
+    ParticleKdTree();
+
+    /** Builds the tree over the positions of the given particles, splitting the work across the pool. */
+    void build(Particle *const *particles, unsigned count, WorkerPool &pool = WorkerPool::getDefault());
+
+    /**
+     *  Updates the tree for the given particles, which have moved since it was built. The bounding boxes are refitted
+     *  around the new positions without changing the structure of the tree.
+     *
+     *  @param particles the same particles the tree was built from
+     *  @param moved the indices of the particles that moved
+     *  @param movedCount the number of indices in moved
+     */
+    void refit(Particle *const *particles, const unsigned *moved, unsigned movedCount);
+
+    /**
+     *  Refits the tree if no more than the given fraction of the particles moved, and rebuilds it otherwise.
+     */
+    void update(Particle *const *particles, const unsigned *moved, unsigned movedCount,
+                real rebuildFraction = (real)0.1, WorkerPool &pool = WorkerPool::getDefault());
+
+    /** Returns the number of particles in the tree. */
+    unsigned size() const;
+
+    /**
+     *  Finds the k particles closest to the given point.
+     *
+     *  @param indices receives the indices of the particles found, closest first; room for k entries
+     *  @param squareDistances receives the squared distance to each particle found; room for k entries
+     *  @return the number of particles found, which is less than k only if the tree holds fewer than k particles
+     */
+    unsigned nearest(const Vector2D &point, unsigned k, unsigned *indices, real *squareDistances) const;
+
+    /** Returns the index of the particle closest to the given point. The tree must not be empty. */
+    unsigned nearest(const Vector2D &point) const;
+
+    /** Appends the indices of all the particles within the given radius of the point, and returns how many. */
+    unsigned withinRadius(const Vector2D &point, real radius, std::vector<unsigned> &result) const;
+
+    /**
+     *  Runs a k nearest neighbour query for each of the given points, in parallel. The results for point i are
+     *  written to indices[i * k] and squareDistances[i * k]; unused entries hold the particle count and REAL_MAX.
+     */
+    void nearest(const Vector2D *points, unsigned count, unsigned k, unsigned *indices, real *squareDistances,
+                 WorkerPool &pool = WorkerPool::getDefault()) const;
+};
+}   // namespace tacoTruck
+#endif // PHYSICS_PKDTREE_HPP_
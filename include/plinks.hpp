@@ -0,0 +1,102 @@
+#ifndef PHYSICS_PLINKS_HPP_
+#define PHYSICS_PLINKS_HPP_
+/*
+ * Links hold pairs of particles together as hard constraints, rather than with stiff springs. They are enforced after
+ * integration by moving the particles back to a valid position, and the velocity of each particle is updated to match
+ * how far it was moved.
+ *
+ * The links are stored as arrays of particle indices and lengths. They are grouped by graph coloring so that no two
+ * links of the same color share a particle; the links of one color can then be solved in parallel, and the colors one
+ * after the other.
+ *
+ */
+#include <vector>
+#include "Vector2D.hpp"
+#include "particle.hpp"
+#include "parallel.hpp"
+
+namespace tacoTruck {
+/** A cable stops two particles moving further apart than its length, but lets them move closer together. */
+struct ParticleCable {
+    unsigned a;         /**< The index of the first particle in the solver. */
+    unsigned b;         /**< The index of the second particle in the solver. */
+    real maxLength;     /**< Holds the maximum length of the cable. */
+};
+
+/** A rod keeps two particles exactly its length apart. */
+struct ParticleRod {
+    unsigned a;         /**< The index of the first particle in the solver. */
+    unsigned b;         /**< The index of the second particle in the solver. */
+    real length;        /**< Holds the length of the rod. */
+};
+
+/** Holds a set of particles and the links between them, and enforces the links with an iterative solver. */
+class ParticleLinkSolver {
+protected:
+    std::vector<Particle*> particles;
+
+    /** The links, grouped by color once colored. */
+    std::vector<unsigned> linkA;
+    std::vector<unsigned> linkB;
+    std::vector<real> linkLength;
+    std::vector<unsigned char> linkIsRod;
+
+    /** The first link of each color, followed by the number of links. */
+    std::vector<unsigned> colorStart;
+    bool colored;
+
+    /**
+     *  The particle each particle's position is measured from while solving, shared by every particle in the same
+     *  group of connected links. Solving relative to it keeps the links precise far from the origin under PREC_MIXED.
+     */
+    std::vector<unsigned> reference;
+
+    /** Scratch copies of the particle state used while solving, relative to each particle's reference. */
+    std::vector<real> positionX;
+    std::vector<real> positionY;
+    std::vector<real> startX;
+    std::vector<real> startY;
+    std::vector<real> inverseMass;
+
+    /** Colors the links and reorders them so that each color is contiguous. */
+    void color();
+
+    /** Finds the groups of particles connected by links and picks the reference particle of each. */
+    void findReferences();
+
+    /** Projects the links [begin, end) onto their constraints. */
+    void solveLinks(unsigned begin, unsigned end);
+
+    void addLink(unsigned a, unsigned b, real length, bool rod);
+
+public:
+    ParticleLinkSolver();
+
+    /** Adds the given particle to the solver and returns the index links should use to refer to it. */
+    unsigned add(Particle *particle);
+
+    /** Adds a cable between two particles already in the solver. */
+    void add(const ParticleCable &cable);
+
+    /** Adds a rod between two particles already in the solver. */
+    void add(const ParticleRod &rod);
+
+    /** Removes all the particles and links. The particles themselves are not deleted. */
+    void clear();
+
+    unsigned getLinkCount() const;
+
+    /** Returns the number of colors the links are split into, coloring them first if needed. */
+    unsigned getColorCount();
+
+    /**
+     *  Moves the particles so that they satisfy the links. This should be called after the particles are integrated.
+     *
+     *  @param duration the duration of the step just integrated, used to update the velocities
+     *  @param iterations the number of passes over all the links; more passes give stiffer links
+     *  @param pool the threads to spread the links of each color across
+     */
+    void solve(real duration, unsigned iterations, WorkerPool &pool = WorkerPool::getDefault());
+};
+}   // namespace tacoTruck
+#endif // PHYSICS_PLINKS_HPP_
@@ -6,6 +6,21 @@
  * The physics system uses single-precision (float) by default, but can be compiled for double-precision (double) by
  * defining the variable PREC_DOUBLE.
  *
+ * Defining PREC_MIXED instead keeps single-precision for velocities and forces, but stores each particle's position
+ * as an integer grid cell plus a single-precision offset within the cell, so positions stay accurate far from the
+ * origin. Forces are then summed with compensated (Kahan) summation. Don't combine it with -ffast-math, which is free
+ * to optimise the compensation away.
+ *
+ * PREC_MIXED covers Particle itself, ParticleSpring and ParticleBungee, the integrators in pintegrator.hpp, the link
+ * solver, ParticleWorldBatch and StaticCollisionWorld::resolve. The following still work in absolute single-precision
+ * coordinates, so far from the origin they are only as precise as a float there:
+ *  - StaticCollisionWorld's geometry, sweep and detect, including the contact points they report
+ *  - ParticleKdTree
+ *  - ParticlePotentialField's grid and sampling
+ *  - ParticleSimulationDriver's interpolated positions
+ *  - the positions in scenario files, which are stored as reals
+ *  - ParticleAnchoredSpring, ParticleUplift and ParticleAttraction, which measure getPosition() from a fixed point
+ *
  * Author: Nathan Hemmings
  *
  * Date created: 07/01/2015
@@ -14,6 +29,10 @@
 #include <float.h>
 
 namespace tacoTruck {
+	#if defined(PREC_DOUBLE) && defined(PREC_MIXED)
+		#error "PREC_DOUBLE and PREC_MIXED can't be used together"
+	#endif
+
 	#ifndef PREC_DOUBLE
 		typedef float real;
 		#define REAL_MAX FLT_MAX
@@ -22,6 +41,11 @@ namespace tacoTruck {
 		#define REAL_MAX DBL_MAX
 	#endif
 
+	#ifdef PREC_MIXED
+		/** The size of the grid cells that positions are stored relative to. A power of two keeps rebasing exact. */
+		#define POSITION_CELL_SIZE 1024.0f
+	#endif
+
 	#define real_pow powf
 	#define real_abs fabs
 }	// End namespace tacoTruck
@@ -0,0 +1,166 @@
+#ifndef PHYSICS_PSCENARIO_HPP_
+#define PHYSICS_PSCENARIO_HPP_
+/*
+ * Bulk construction of large particle worlds, and a streaming loader and writer for scenario files.
+ *
+ * A ParticleScenario owns its particles, force generators and registry. The particles are allocated in large blocks,
+ * so their addresses never change as more are added, and their state is filled in from columns of values in
+ * parallel rather than through one set of setter calls per particle.
+ *
+ * A scenario file is columnar and written in chunks, so it can be written and read without holding the whole world in
+ * memory twice:
+ *
+ *     header          "TTSC", version, size of real, particle count, generator count, registration count
+ *     particle chunks count, then count values of each column: inverse mass, position x, position y, velocity x,
+ *                     velocity y, acceleration x, acceleration y, damping
+ *     generators      one fixed-size record each: type, particle index, six parameters
+ *     registration    count, then count particle indices and count generator indices
+ *     chunks
+ *
+ * All values are stored in the native byte order, and reals at the precision the engine was compiled with.
+ *
+ */
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include "Vector2D.hpp"
+#include "particle.hpp"
+#include "pfgen.hpp"
+#include "parallel.hpp"
+
+namespace tacoTruck {
+/** Describes one force generator in a scenario by its type and parameters. */
+struct ParticleGeneratorRecord {
+    enum Type {
+        GRAVITY,            /**< params: gravity x, gravity y */
+        DRAG,               /**< params: k1, k2 */
+        SPRING,             /**< other: particle at the other end; params: spring constant, rest length */
+        ANCHORED_SPRING,    /**< params: anchor x, anchor y, spring constant, rest length */
+        BUNGEE,             /**< other: particle at the other end; params: spring constant, rest length */
+        UPLIFT,             /**< params: uplift x, uplift y, origin x, origin y, range */
+        AIRBRAKE,           /**< params: k1, k2, active (non-zero) */
+        ATTRACTION          /**< params: magnitude, origin x, origin y */
+    };
+
+    unsigned type;
+    unsigned other;
+    real params[6];
+};
+
+/** Columns of particle state, each holding one value per particle. */
+struct ParticleColumns {
+    const real *inverseMass;
+    const real *positionX;
+    const real *positionY;
+    const real *velocityX;
+    const real *velocityY;
+    const real *accelerationX;
+    const real *accelerationY;
+    const real *damping;
+};
+
+class ParticleScenario {
+protected:
+    /** The particles, in blocks of a fixed size that are never moved. */
+    std::vector<Particle*> blocks;
+    unsigned particleCount;
+
+    /** The force generators, owned by the scenario. */
+    std::vector<ParticleForceGenerator*> generators;
+
+    /** The anchors of anchored springs, which hold a pointer to them. */
+    std::deque<Vector2D> anchors;
+
+    ParticleForceRegistry registry;
+
+public:
+    ParticleScenario();
+    ~ParticleScenario();
+
+    ParticleScenario(const ParticleScenario&) = delete;
+    ParticleScenario &operator=(const ParticleScenario&) = delete;
+
+    /** Deletes all the particles and generators, and clears the registry. */
+    void clear();
+
+    /** Adds the given number of default particles and returns the index of the first. */
+    unsigned addParticles(unsigned count);
+
+    /** Sets the state of count particles, starting at the given index, from the given columns, in parallel. */
+    void setParticles(unsigned first, unsigned count, const ParticleColumns &columns,
+                      WorkerPool &pool = WorkerPool::getDefault());
+
+    Particle *getParticle(unsigned index);
+    unsigned getParticleCount() const;
+
+    /**
+     *  Creates a force generator from the given record.
+     *
+     *  @param index if not null, receives the index of the new generator
+     *  @return false if the record has an unknown type or refers to a particle that doesn't exist, in which case
+     *          nothing is added
+     */
+    bool addGenerator(const ParticleGeneratorRecord &record, unsigned *index = nullptr);
+
+    /** Takes ownership of the given force generator and returns its index. */
+    unsigned addGenerator(ParticleForceGenerator *fg);
+
+    ParticleForceGenerator *getGenerator(unsigned index);
+    unsigned getGeneratorCount() const;
+
+    /** Registers generators[i] to apply to particles[i] for each i, given by index, in parallel. */
+    void addRegistrations(const unsigned *particles, const unsigned *generators, unsigned count,
+                          WorkerPool &pool = WorkerPool::getDefault());
+
+    ParticleForceRegistry &getRegistry();
+
+    /**
+     *  Reads a scenario file, adding its particles, generators and registrations to this scenario. The file is read
+     *  one chunk at a time, and storage for each chunk is only allocated as its data is read.
+     *
+     *  @return false if the file could not be read or is not a valid scenario file, in which case the scenario may
+     *          hold part of its contents
+     */
+    bool load(const char *path, WorkerPool &pool = WorkerPool::getDefault());
+};
+
+/** Writes a scenario file. The particles, generators and registrations must be written in that order. */
+class ParticleScenarioWriter {
+protected:
+    std::FILE *file;
+    unsigned particleCount;
+    unsigned generatorCount;
+    unsigned registrationCount;
+    unsigned written;       /**< The number of items written in the current section. */
+    unsigned section;       /**< 0 for particles, 1 for generators, 2 for registrations, 3 when done. */
+    bool failed;
+
+    /** Moves on to the next section that still expects items. */
+    void advance();
+
+    void write(const void *data, size_t size, size_t count);
+
+public:
+    ParticleScenarioWriter();
+    ~ParticleScenarioWriter();
+
+    ParticleScenarioWriter(const ParticleScenarioWriter&) = delete;
+    ParticleScenarioWriter &operator=(const ParticleScenarioWriter&) = delete;
+
+    /** Opens the file and writes the header. The counts must match the number of items written afterwards. */
+    bool open(const char *path, unsigned particleCount, unsigned generatorCount, unsigned registrationCount);
+
+    /** Writes the next count particles as one chunk. */
+    void writeParticles(unsigned count, const ParticleColumns &columns);
+
+    /** Writes the next generator. */
+    void writeGenerator(const ParticleGeneratorRecord &record);
+
+    /** Writes the next count registrations as one chunk. */
+    void writeRegistrations(const unsigned *particles, const unsigned *generators, unsigned count);
+
+    /** Closes the file, returning false if anything failed to write or the counts did not match. */
+    bool close();
+};
+}   // namespace tacoTruck
+#endif // PHYSICS_PSCENARIO_HPP_
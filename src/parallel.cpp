@@ -0,0 +1,103 @@
+/*
+ * Implementation of the worker pool.
+ *
+ */
+#include <assert.h>
+#include <algorithm>
+#include "parallel.hpp"
+
+using namespace tacoTruck;
+
+WorkerPool::WorkerPool(unsigned threadCount) : threads(),
+                                               mutex(),
+                                               runMutex(),
+                                               wake(),
+                                               done(),
+                                               task(nullptr),
+                                               count(0),
+                                               grain(1),
+                                               next(0),
+                                               busy(0),
+                                               generation(0),
+                                               stopping(false)
+{
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    // The thread calling run does its share of the work, so it needs one fewer worker.
+    for (unsigned i = 1; i < threadCount; i++) {
+        threads.push_back(std::thread(&WorkerPool::work, this));
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+unsigned WorkerPool::getThreadCount() const {
+    return (unsigned)threads.size() + 1;
+}
+
+void WorkerPool::work() {
+    unsigned seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        while (!stopping && generation == seen) wake.wait(lock);
+        if (stopping) return;
+        seen = generation;
+
+        lock.unlock();
+        process();
+        lock.lock();
+
+        if (--busy == 0) done.notify_one();
+    }
+}
+
+void WorkerPool::process() {
+    for (;;) {
+        const unsigned begin = next.fetch_add(grain);
+        if (begin >= count) return;
+        (*task)(begin, std::min(count, begin + grain));
+    }
+}
+
+void WorkerPool::run(unsigned count, unsigned grain, const Task &task) {
+    if (count == 0) return;
+    if (grain == 0) grain = 1;
+
+    // Not worth waking anyone for a single range.
+    if (threads.empty() || count <= grain) {
+        task(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(runMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        WorkerPool::task = &task;
+        WorkerPool::count = count;
+        WorkerPool::grain = grain;
+        next.store(0);
+        busy = (unsigned)threads.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    process();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (busy != 0) done.wait(lock);
+    WorkerPool::task = nullptr;
+}
+
+WorkerPool &WorkerPool::getDefault() {
+    static WorkerPool pool;
+    return pool;
+}
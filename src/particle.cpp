@@ -18,6 +18,11 @@ Particle::Particle() : inverseMass(1.0f),
                        velocity(0, 0),
                        acceleration(0, 0),
                        forceAccum(0,0)
+#ifdef PREC_MIXED
+                       , cellX(0),
+                       cellY(0),
+                       forceCompensation(0, 0)
+#endif
 {}
 
 void Particle::integrate(real duration) {
@@ -27,6 +32,9 @@ void Particle::integrate(real duration) {
 
     // Update linear position
     position.addScaledVector(velocity, duration);
+#ifdef PREC_MIXED
+    rebaseCell();
+#endif
 
     // Account for acceleration due to forces
     Vector2D resultingAcc = acceleration;
@@ -73,6 +81,63 @@ real Particle::getDamping() const
     return damping;
 }
 
+#ifdef PREC_MIXED
+void Particle::rebaseCell() {
+    const real cellsX = std::floor(position.x / POSITION_CELL_SIZE);
+    const real cellsY = std::floor(position.y / POSITION_CELL_SIZE);
+    if (cellsX != 0) {
+        cellX += (int)cellsX;
+        position.x -= cellsX * POSITION_CELL_SIZE;
+    }
+    if (cellsY != 0) {
+        cellY += (int)cellsY;
+        position.y -= cellsY * POSITION_CELL_SIZE;
+    }
+}
+
+void Particle::setPosition(const Vector2D& position) {
+    setWorldPosition(position.x, position.y);
+}
+
+void Particle::setPosition(const real x, const real y) {
+    setWorldPosition(x, y);
+}
+
+void Particle::getPosition(Vector2D* position) const {
+    *position = getPosition();
+}
+
+Vector2D Particle::getPosition() const {
+    return Vector2D((real)(cellX * (double)POSITION_CELL_SIZE + position.x),
+                    (real)(cellY * (double)POSITION_CELL_SIZE + position.y));
+}
+
+void Particle::setWorldPosition(const double x, const double y) {
+    const double cellsX = std::floor(x / POSITION_CELL_SIZE);
+    const double cellsY = std::floor(y / POSITION_CELL_SIZE);
+    cellX = (int)cellsX;
+    cellY = (int)cellsY;
+    position.x = (real)(x - cellsX * POSITION_CELL_SIZE);
+    position.y = (real)(y - cellsY * POSITION_CELL_SIZE);
+    rebaseCell();
+}
+
+void Particle::getWorldPosition(double* x, double* y) const {
+    *x = cellX * (double)POSITION_CELL_SIZE + position.x;
+    *y = cellY * (double)POSITION_CELL_SIZE + position.y;
+}
+
+Vector2D Particle::getOffsetFrom(const Particle& other) const {
+    // The cells are exact, so only the offsets within them are rounded.
+    return Vector2D((cellX - other.cellX) * POSITION_CELL_SIZE + (position.x - other.position.x),
+                    (cellY - other.cellY) * POSITION_CELL_SIZE + (position.y - other.position.y));
+}
+
+void Particle::translate(const Vector2D& offset) {
+    position += offset;
+    rebaseCell();
+}
+#else
 void Particle::setPosition(const Vector2D& position) {
     Particle::position = position;
 }
@@ -90,6 +155,25 @@ Vector2D Particle::getPosition() const {
     return position;
 }
 
+void Particle::setWorldPosition(const double x, const double y) {
+    position.x = (real)x;
+    position.y = (real)y;
+}
+
+void Particle::getWorldPosition(double* x, double* y) const {
+    *x = position.x;
+    *y = position.y;
+}
+
+Vector2D Particle::getOffsetFrom(const Particle& other) const {
+    return position - other.position;
+}
+
+void Particle::translate(const Vector2D& offset) {
+    position += offset;
+}
+#endif
+
 void Particle::setVelocity(const Vector2D& velocity) {
     Particle::velocity = velocity;
 }
@@ -130,8 +214,27 @@ bool Particle::hasFiniteMass() const {
 
 void Particle::clearAccumulator() {
     forceAccum.clear();
+#ifdef PREC_MIXED
+    forceCompensation.clear();
+#endif
 }
 
 void Particle::addForce(const Vector2D& force) {
+#ifdef PREC_MIXED
+    // Kahan summation: carry the part of each force lost to rounding into the next addition.
+    const Vector2D corrected = force - forceCompensation;
+    const Vector2D sum = forceAccum + corrected;
+    forceCompensation = (sum - forceAccum) - corrected;
+    forceAccum = sum;
+#else
     forceAccum += force;
+#endif
+}
+
+void Particle::getAccumulatedForce(Vector2D* force) const {
+    *force = forceAccum;
+}
+
+Vector2D Particle::getAccumulatedForce() const {
+    return forceAccum;
 }
@@ -0,0 +1,282 @@
+/*
+ * Implementation of the batch of particle worlds.
+ *
+ */
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include "pbatch.hpp"
+
+using namespace tacoTruck;
+
+namespace {
+    /** Roughly how many particles each job handed to the worker pool should hold. */
+    const unsigned particlesPerJob = 4096;
+
+    /**
+     *  Each world takes a whole number of blocks of this many particle slots, and the loops process a block at a time
+     *  with a fixed trip count, so the compiler can vectorise them without a scalar remainder or runtime checks.
+     */
+    const unsigned lanes = 8;
+
+    /**
+     *  Attraction is computed as if the particle were at least this far from the origin, which only matters when it
+     *  sits on the origin and the direction is zero anyway. It saves a branch in the force loop.
+     */
+    const real minAttractionDistance = (real)1e-6;
+
+    /** Sets the acceleration from gravity, drag and attraction, for the blocks in [first, last). */
+    void applyFields(unsigned first, unsigned last,
+                     const real *__restrict px, const real *__restrict py,
+                     const real *__restrict vx, const real *__restrict vy,
+                     const real *__restrict im, const real *__restrict mv,
+                     const real *__restrict gx, const real *__restrict gy,
+                     const real *__restrict k1, const real *__restrict k2,
+                     const real *__restrict attraction,
+                     const real *__restrict ox, const real *__restrict oy,
+                     real *__restrict fx, real *__restrict fy) {
+        for (size_t block = first; block < last; block += lanes) {
+            for (unsigned l = 0; l < lanes; l++) {
+                const size_t i = block + l;
+
+                // Drag opposes the velocity with a magnitude of k1 * speed + k2 * speed^2
+                const real speed = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+                const real drag = (k1[i] + k2[i] * speed) * im[i];
+
+                // Attraction has a constant magnitude towards the origin
+                const real dx = ox[i] - px[i];
+                const real dy = oy[i] - py[i];
+                const real distance = std::sqrt(dx * dx + dy * dy);
+                const real pull = attraction[i] / std::max(distance, minAttractionDistance);
+
+                fx[i] = mv[i] * (gx[i] + dx * pull) - vx[i] * drag;
+                fy[i] = mv[i] * (gy[i] + dy * pull) - vy[i] * drag;
+            }
+        }
+    }
+
+    /** Integrates the particles in the blocks in [first, last), as Particle::integrate does. */
+    void integrateBlocks(unsigned first, unsigned last, real duration,
+                         real *__restrict px, real *__restrict py,
+                         real *__restrict vx, real *__restrict vy,
+                         const real *__restrict ax, const real *__restrict ay,
+                         const real *__restrict fx, const real *__restrict fy,
+                         const real *__restrict df, const real *__restrict mv) {
+        for (size_t block = first; block < last; block += lanes) {
+            for (unsigned l = 0; l < lanes; l++) {
+                const size_t i = block + l;
+                px[i] += vx[i] * duration * mv[i];
+                py[i] += vy[i] * duration * mv[i];
+                const real nvx = (vx[i] + (ax[i] * mv[i] + fx[i]) * duration) * df[i];
+                const real nvy = (vy[i] + (ay[i] * mv[i] + fy[i]) * duration) * df[i];
+                vx[i] += mv[i] * (nvx - vx[i]);
+                vy[i] += mv[i] * (nvy - vy[i]);
+            }
+        }
+    }
+}
+
+ParticleWorldBatch::ParticleWorldBatch() : worlds(),
+                                           positionX(), positionY(),
+                                           velocityX(), velocityY(),
+                                           accelerationX(), accelerationY(),
+                                           inverseMass(), damping(), moving(),
+                                           gravityX(), gravityY(), dragK1(), dragK2(),
+                                           attraction(), attractionX(), attractionY(),
+                                           accumX(), accumY(),
+                                           springA(), springB(), springConstant(), springRestLength(),
+                                           dampingFactor()
+{}
+
+unsigned ParticleWorldBatch::addWorld() {
+    World world;
+    world.firstParticle = (unsigned)positionX.size();
+    world.firstSpring = (unsigned)springA.size();
+    worlds.push_back(world);
+    return (unsigned)worlds.size() - 1;
+}
+
+void ParticleWorldBatch::addBlock(const World &world) {
+    // Padding particles have no mass and never move.
+    const size_t size = positionX.size() + lanes;
+    positionX.resize(size, 0);
+    positionY.resize(size, 0);
+    velocityX.resize(size, 0);
+    velocityY.resize(size, 0);
+    accelerationX.resize(size, 0);
+    accelerationY.resize(size, 0);
+    inverseMass.resize(size, 0);
+    damping.resize(size, 1);
+    moving.resize(size, 0);
+    gravityX.resize(size, world.gravity.x);
+    gravityY.resize(size, world.gravity.y);
+    dragK1.resize(size, world.dragK1);
+    dragK2.resize(size, world.dragK2);
+    attraction.resize(size, world.attractionMagnitude);
+    attractionX.resize(size, (real)(world.attractionOrigin.x - world.originX));
+    attractionY.resize(size, (real)(world.attractionOrigin.y - world.originY));
+    accumX.resize(size, 0);
+    accumY.resize(size, 0);
+    dampingFactor.resize(size, 1);
+}
+
+void ParticleWorldBatch::setParameters(const World &world) {
+    for (unsigned i = world.firstParticle; i < endOf(world); i++) {
+        gravityX[i] = world.gravity.x;
+        gravityY[i] = world.gravity.y;
+        dragK1[i] = world.dragK1;
+        dragK2[i] = world.dragK2;
+        attraction[i] = world.attractionMagnitude;
+        attractionX[i] = (real)(world.attractionOrigin.x - world.originX);
+        attractionY[i] = (real)(world.attractionOrigin.y - world.originY);
+    }
+}
+
+unsigned ParticleWorldBatch::endOf(const World &world) const {
+    return world.firstParticle + (world.particleCount + lanes - 1) / lanes * lanes;
+}
+
+unsigned ParticleWorldBatch::addParticle(unsigned world, const Particle &particle) {
+    assert(world + 1 == worlds.size());
+    World &w = worlds[world];
+    double x, y;
+    particle.getWorldPosition(&x, &y);
+
+    // The first particle sets the origin, before the world has any slots to copy the attraction origin out to.
+    if (w.particleCount == 0) {
+        w.originX = x;
+        w.originY = y;
+    }
+    const unsigned i = w.firstParticle + w.particleCount;
+    if (i == positionX.size()) addBlock(w);
+
+    const Vector2D velocity = particle.getVelocity();
+    const Vector2D acceleration = particle.getAcceleration();
+    positionX[i] = (real)(x - w.originX);
+    positionY[i] = (real)(y - w.originY);
+    velocityX[i] = velocity.x;
+    velocityY[i] = velocity.y;
+    accelerationX[i] = acceleration.x;
+    accelerationY[i] = acceleration.y;
+    inverseMass[i] = std::max((real)0, particle.getInverseMass());
+    damping[i] = particle.getDamping();
+    moving[i] = particle.getInverseMass() > 0.0f ? (real)1 : (real)0;
+    return w.particleCount++;
+}
+
+void ParticleWorldBatch::addSpring(unsigned world, unsigned a, unsigned b, real springConstant, real restLength) {
+    assert(world + 1 == worlds.size());
+    World &w = worlds[world];
+    assert(a < w.particleCount && b < w.particleCount);
+    springA.push_back(w.firstParticle + a);
+    springB.push_back(w.firstParticle + b);
+    ParticleWorldBatch::springConstant.push_back(springConstant);
+    springRestLength.push_back(restLength);
+    w.springCount++;
+}
+
+void ParticleWorldBatch::setGravity(unsigned world, const Vector2D &gravity) {
+    worlds[world].gravity = gravity;
+    setParameters(worlds[world]);
+}
+
+void ParticleWorldBatch::setDrag(unsigned world, real k1, real k2) {
+    worlds[world].dragK1 = k1;
+    worlds[world].dragK2 = k2;
+    setParameters(worlds[world]);
+}
+
+void ParticleWorldBatch::setAttraction(unsigned world, real magnitude, const Vector2D &origin) {
+    worlds[world].attractionMagnitude = magnitude;
+    worlds[world].attractionOrigin = origin;
+    setParameters(worlds[world]);
+}
+
+void ParticleWorldBatch::clear() {
+    *this = ParticleWorldBatch();
+}
+
+unsigned ParticleWorldBatch::getWorldCount() const {
+    return (unsigned)worlds.size();
+}
+
+unsigned ParticleWorldBatch::getParticleCount(unsigned world) const {
+    return worlds[world].particleCount;
+}
+
+void ParticleWorldBatch::stepWorlds(unsigned begin, unsigned end, real duration) {
+    real *px = &positionX[0];
+    real *py = &positionY[0];
+    real *vx = &velocityX[0];
+    real *vy = &velocityY[0];
+    real *fx = &accumX[0];
+    real *fy = &accumY[0];
+    const real *im = &inverseMass[0];
+    const real *mv = &moving[0];
+    const unsigned first = worlds[begin].firstParticle;
+    const unsigned last = endOf(worlds[end - 1]);
+
+    // Generators that act on each particle alone, for every particle of the chunk in one pass
+    applyFields(first, last, px, py, vx, vy, im, mv, &gravityX[0], &gravityY[0], &dragK1[0], &dragK2[0],
+                &attraction[0], &attractionX[0], &attractionY[0], fx, fy);
+
+    // Springs; the springs of consecutive worlds are consecutive too
+    const unsigned firstSpring = worlds[begin].firstSpring;
+    const unsigned lastSpring = worlds[end - 1].firstSpring + worlds[end - 1].springCount;
+    for (unsigned s = firstSpring; s < lastSpring; s++) {
+        const unsigned a = springA[s];
+        const unsigned b = springB[s];
+        const real dx = px[a] - px[b];
+        const real dy = py[a] - py[b];
+        const real length = std::sqrt(dx * dx + dy * dy);
+        if (length <= 0) continue;
+        // As ParticleSpring, the force always pulls the ends together, by the distance from the rest length.
+        const real force = -springConstant[s] * std::fabs(length - springRestLength[s]) / length;
+        fx[a] += dx * force * im[a];
+        fy[a] += dy * force * im[a];
+        fx[b] -= dx * force * im[b];
+        fy[b] -= dy * force * im[b];
+    }
+
+    // Integrate every particle of the chunk in one pass
+    integrateBlocks(first, last, duration, px, py, vx, vy, &accelerationX[0], &accelerationY[0], fx, fy,
+                    &dampingFactor[0], mv);
+}
+
+void ParticleWorldBatch::run(real duration, unsigned steps, WorkerPool &pool) {
+    assert(duration > 0.0f);
+    if (worlds.empty() || positionX.empty()) return;
+
+    const unsigned averageParticles = std::max(1u, (unsigned)positionX.size() / (unsigned)worlds.size());
+    const unsigned grain = std::max(1u, particlesPerJob / averageParticles);
+
+    pool.run((unsigned)worlds.size(), grain, [this, duration, steps](unsigned begin, unsigned end) {
+        const unsigned first = worlds[begin].firstParticle;
+        const unsigned last = endOf(worlds[end - 1]);
+        for (unsigned i = first; i < last; i++) {
+            dampingFactor[i] = std::pow(damping[i], duration);
+        }
+
+        for (unsigned step = 0; step < steps; step++) {
+            stepWorlds(begin, end, duration);
+        }
+    });
+}
+
+Vector2D ParticleWorldBatch::getPosition(unsigned world, unsigned index) const {
+    const World &w = worlds[world];
+    const unsigned i = w.firstParticle + index;
+    return Vector2D((real)(w.originX + positionX[i]), (real)(w.originY + positionY[i]));
+}
+
+Vector2D ParticleWorldBatch::getVelocity(unsigned world, unsigned index) const {
+    const unsigned i = worlds[world].firstParticle + index;
+    return Vector2D(velocityX[i], velocityY[i]);
+}
+
+void ParticleWorldBatch::getParticle(unsigned world, unsigned index, Particle *particle) const {
+    const World &w = worlds[world];
+    const unsigned i = w.firstParticle + index;
+    particle->setWorldPosition(w.originX + positionX[i], w.originY + positionY[i]);
+    particle->setVelocity(getVelocity(world, index));
+}
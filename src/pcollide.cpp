@@ -0,0 +1,258 @@
+/*
+ * Implementation of the static collision world.
+ *
+ */
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <limits.h>
+#include "pcollide.hpp"
+
+using namespace tacoTruck;
+
+namespace {
+    /** Leaves hold at most this many segments. */
+    const unsigned leafSize = 4;
+
+    /** The deepest hierarchy a query can walk. A median split keeps the depth near log2 of the segment count. */
+    const unsigned maxDepth = 64;
+
+    /** The number of particles handed to each worker at once. */
+    const unsigned grain = 1024;
+
+    const unsigned noParticle = UINT_MAX;
+
+    real cross(const Vector2D &a, const Vector2D &b) {
+        return a.x * b.y - a.y * b.x;
+    }
+
+    /** Returns true if the path from + t * direction, for t in [0, maxTime], passes through the given box. */
+    bool pathHitsBox(const Vector2D &from, const Vector2D &inverseDirection, real maxTime,
+                     const Vector2D &min, const Vector2D &max) {
+        real t1 = (min.x - from.x) * inverseDirection.x;
+        real t2 = (max.x - from.x) * inverseDirection.x;
+        real enter = std::min(t1, t2);
+        real exit = std::max(t1, t2);
+        t1 = (min.y - from.y) * inverseDirection.y;
+        t2 = (max.y - from.y) * inverseDirection.y;
+        enter = std::max(enter, std::min(t1, t2));
+        exit = std::min(exit, std::max(t1, t2));
+        return enter <= exit && exit >= 0 && enter <= maxTime;
+    }
+}
+
+StaticCollisionWorld::StaticCollisionWorld() : nodes(),
+                                               segmentStart(), segmentEnd(), segmentId(),
+                                               planeNormal(), planeOffset(),
+                                               built(false)
+{}
+
+unsigned StaticCollisionWorld::addSegment(const Vector2D &start, const Vector2D &end) {
+    segmentStart.push_back(start);
+    segmentEnd.push_back(end);
+    segmentId.push_back((unsigned)segmentId.size());
+    built = false;
+    return (unsigned)segmentId.size() - 1;
+}
+
+unsigned StaticCollisionWorld::addPlane(const Vector2D &normal, real offset) {
+    planeNormal.push_back(normal);
+    planeOffset.push_back(offset);
+    return (unsigned)planeOffset.size() - 1;
+}
+
+void StaticCollisionWorld::clear() {
+    nodes.clear();
+    segmentStart.clear();
+    segmentEnd.clear();
+    segmentId.clear();
+    planeNormal.clear();
+    planeOffset.clear();
+    built = false;
+}
+
+unsigned StaticCollisionWorld::buildNode(unsigned begin, unsigned end, std::vector<Vector2D> &centre) {
+    const unsigned index = (unsigned)nodes.size();
+    nodes.push_back(Node());
+
+    Node node;
+    node.min = node.max = segmentStart[begin];
+    Vector2D centreMin = centre[begin];
+    Vector2D centreMax = centre[begin];
+    for (unsigned i = begin; i < end; i++) {
+        node.min.x = std::min(node.min.x, std::min(segmentStart[i].x, segmentEnd[i].x));
+        node.min.y = std::min(node.min.y, std::min(segmentStart[i].y, segmentEnd[i].y));
+        node.max.x = std::max(node.max.x, std::max(segmentStart[i].x, segmentEnd[i].x));
+        node.max.y = std::max(node.max.y, std::max(segmentStart[i].y, segmentEnd[i].y));
+        centreMin.x = std::min(centreMin.x, centre[i].x);
+        centreMin.y = std::min(centreMin.y, centre[i].y);
+        centreMax.x = std::max(centreMax.x, centre[i].x);
+        centreMax.y = std::max(centreMax.y, centre[i].y);
+    }
+
+    if (end - begin <= leafSize) {
+        node.index = begin;
+        node.count = end - begin;
+        nodes[index] = node;
+        return index;
+    }
+
+    // Split at the median centre along the longer axis. The segments are sorted through an index array and the
+    // segment arrays permuted to match afterwards.
+    const bool splitX = centreMax.x - centreMin.x >= centreMax.y - centreMin.y;
+    const unsigned middle = begin + (end - begin) / 2;
+    std::vector<unsigned> order(end - begin);
+    for (unsigned i = 0; i < order.size(); i++) order[i] = begin + i;
+    std::nth_element(order.begin(), order.begin() + (middle - begin), order.end(),
+                     [&centre, splitX](unsigned a, unsigned b) {
+                         return splitX ? centre[a].x < centre[b].x : centre[a].y < centre[b].y;
+                     });
+
+    std::vector<Vector2D> start(order.size()), finish(order.size()), mid(order.size());
+    std::vector<unsigned> id(order.size());
+    for (unsigned i = 0; i < order.size(); i++) {
+        start[i] = segmentStart[order[i]];
+        finish[i] = segmentEnd[order[i]];
+        mid[i] = centre[order[i]];
+        id[i] = segmentId[order[i]];
+    }
+    std::copy(start.begin(), start.end(), segmentStart.begin() + begin);
+    std::copy(finish.begin(), finish.end(), segmentEnd.begin() + begin);
+    std::copy(mid.begin(), mid.end(), centre.begin() + begin);
+    std::copy(id.begin(), id.end(), segmentId.begin() + begin);
+
+    buildNode(begin, middle, centre);
+    node.index = buildNode(middle, end, centre);
+    node.count = 0;
+    nodes[index] = node;
+    return index;
+}
+
+void StaticCollisionWorld::build() {
+    nodes.clear();
+    const unsigned count = (unsigned)segmentStart.size();
+    if (count > 0) {
+        std::vector<Vector2D> centre(count);
+        for (unsigned i = 0; i < count; i++) centre[i] = (segmentStart[i] + segmentEnd[i]) * (real)0.5;
+        nodes.reserve(2 * (count / leafSize + 1));
+        buildNode(0, count, centre);
+    }
+    built = true;
+}
+
+bool StaticCollisionWorld::sweep(const Vector2D &from, const Vector2D &to, ParticleStaticContact *contact) const {
+    assert(built);
+    const Vector2D direction = to - from;
+    real best = 1;
+    bool hit = false;
+
+    // Planes
+    for (unsigned i = 0; i < planeOffset.size(); i++) {
+        const real startDistance = from * planeNormal[i] - planeOffset[i];
+        const real endDistance = to * planeNormal[i] - planeOffset[i];
+        if (endDistance >= 0) continue;
+
+        // A particle that starts inside is pushed straight back out.
+        const real t = startDistance > 0 ? startDistance / (startDistance - endDistance) : 0;
+        if (t > best || (hit && t == best)) continue;
+        best = t;
+        hit = true;
+        contact->feature = i;
+        contact->plane = true;
+        contact->normal = planeNormal[i];
+        contact->offset = planeOffset[i];
+        contact->point = startDistance > 0 ? from + direction * t : from - planeNormal[i] * startDistance;
+    }
+
+    // Segments
+    if (!nodes.empty() && (direction.x != 0 || direction.y != 0)) {
+        const Vector2D inverseDirection(direction.x != 0 ? 1 / direction.x : REAL_MAX,
+                                        direction.y != 0 ? 1 / direction.y : REAL_MAX);
+        unsigned stack[maxDepth];
+        unsigned top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node &node = nodes[stack[--top]];
+            if (!pathHitsBox(from, inverseDirection, best, node.min, node.max)) continue;
+
+            if (node.count == 0) {
+                // Visit the left child first; it's next in memory.
+                assert(top + 2 <= maxDepth);
+                stack[top++] = node.index;
+                stack[top++] = (unsigned)(&node - &nodes[0]) + 1;
+                continue;
+            }
+
+            for (unsigned i = node.index; i < node.index + node.count; i++) {
+                const Vector2D edge = segmentEnd[i] - segmentStart[i];
+                const real denominator = cross(direction, edge);
+                if (denominator == 0) continue;
+
+                const Vector2D offset = segmentStart[i] - from;
+                const real t = cross(offset, edge) / denominator;
+                const real u = cross(offset, direction) / denominator;
+                if (t < 0 || t > best || u < 0 || u > 1) continue;
+
+                Vector2D normal(-edge.y, edge.x);
+                if (normal * direction > 0) normal.invert();
+                normal *= 1 / normal.magnitude();
+
+                best = t;
+                hit = true;
+                contact->feature = segmentId[i];
+                contact->plane = false;
+                contact->normal = normal;
+                contact->offset = (double)normal.x * segmentStart[i].x + (double)normal.y * segmentStart[i].y;
+                contact->point = from + direction * t;
+            }
+        }
+    }
+
+    if (hit) contact->time = best;
+    return hit;
+}
+
+unsigned StaticCollisionWorld::detect(Particle *const *particles, const Vector2D *previousPositions, unsigned count,
+                                      ParticleStaticContact *contacts, WorkerPool &pool) const {
+    // The task captures a single reference, so it fits in std::function's own storage and isn't allocated.
+    struct Job {
+        const StaticCollisionWorld *world;
+        Particle *const *particles;
+        const Vector2D *previousPositions;
+        ParticleStaticContact *contacts;
+    } job = { this, particles, previousPositions, contacts };
+    pool.run(count, grain, [&job](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; i++) {
+            ParticleStaticContact *contact = job.contacts + i;
+            const Vector2D position = job.particles[i]->getPosition();
+            contact->particle = job.world->sweep(job.previousPositions[i], position, contact) ? i : noParticle;
+        }
+    });
+
+    // Pack the contacts found to the front of the array.
+    unsigned found = 0;
+    for (unsigned i = 0; i < count; i++) {
+        if (contacts[i].particle == noParticle) continue;
+        if (found != i) contacts[found] = contacts[i];
+        found++;
+    }
+    return found;
+}
+
+void StaticCollisionWorld::resolve(Particle *particle, const ParticleStaticContact &contact, real restitution,
+                                   real clearance) {
+    // Project the contact point onto the surface and step out by the clearance, all at double precision, so neither
+    // the rounding of the contact point nor the clearance being smaller than a real's spacing there leaves the
+    // particle on or behind the surface.
+    const double distance = (double)contact.normal.x * contact.point.x + (double)contact.normal.y * contact.point.y
+                            - contact.offset;
+    const double push = clearance - distance;
+    particle->setWorldPosition(contact.point.x + contact.normal.x * push, contact.point.y + contact.normal.y * push);
+
+    Vector2D velocity = particle->getVelocity();
+    const real separatingVelocity = velocity * contact.normal;
+    if (separatingVelocity < 0) {
+        velocity.addScaledVector(contact.normal, -separatingVelocity * (1 + restitution));
+        particle->setVelocity(velocity);
+    }
+}
@@ -0,0 +1,200 @@
+/*
+ * Implementation of the simulation driver.
+ *
+ */
+#include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include "pdriver.hpp"
+
+using namespace tacoTruck;
+
+namespace {
+    /** Frames that use less than this fraction of the budget count towards raising the quality. */
+    const double calmFraction = 0.5;
+
+    /** The number of calm frames in a row needed before the quality is raised one notch. */
+    const unsigned calmFramesToRestore = 30;
+}
+
+/*******************************************************************************************************************//**
+ *  CLOCKS
+***********************************************************************************************************************/
+
+double SteadyClock::now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ManualClock::ManualClock() : time(0) {}
+
+double ManualClock::now() {
+    return time;
+}
+
+void ManualClock::advance(double seconds) {
+    time += seconds;
+}
+
+/*******************************************************************************************************************//**
+ *  DRIVER
+***********************************************************************************************************************/
+
+ParticleSimulationDriver::ParticleSimulationDriver(SimulationClock *clock, ParticleForceRegistry *registry,
+                                                   real timestep, double budget) :
+                                                                                clock(clock),
+                                                                                registry(registry),
+                                                                                links(nullptr),
+                                                                                particles(),
+                                                                                previousPosition(),
+                                                                                timestep(timestep),
+                                                                                budget(budget),
+                                                                                accumulator(0),
+                                                                                lastTime(0),
+                                                                                started(false),
+                                                                                maxSubsteps(1),
+                                                                                minSubsteps(1),
+                                                                                maxIterations(0),
+                                                                                minIterations(0),
+                                                                                maxStepsPerFrame(8),
+                                                                                calmFrames(0),
+                                                                                statistics()
+{
+    assert(timestep > 0.0f);
+    statistics.substeps = maxSubsteps;
+    statistics.iterations = maxIterations;
+}
+
+void ParticleSimulationDriver::add(Particle *particle) {
+    particles.push_back(particle);
+    previousPosition.push_back(particle->getPosition());
+}
+
+void ParticleSimulationDriver::clear() {
+    particles.clear();
+    previousPosition.clear();
+}
+
+void ParticleSimulationDriver::setLinkSolver(ParticleLinkSolver *links, unsigned iterations, unsigned minIterations) {
+    assert(minIterations <= iterations);
+    ParticleSimulationDriver::links = links;
+    maxIterations = iterations;
+    ParticleSimulationDriver::minIterations = minIterations;
+    statistics.iterations = iterations;
+}
+
+void ParticleSimulationDriver::setSubsteps(unsigned substeps, unsigned minSubsteps) {
+    assert(minSubsteps >= 1 && minSubsteps <= substeps);
+    maxSubsteps = substeps;
+    ParticleSimulationDriver::minSubsteps = minSubsteps;
+    statistics.substeps = substeps;
+}
+
+void ParticleSimulationDriver::setMaxStepsPerFrame(unsigned steps) {
+    assert(steps >= 1);
+    maxStepsPerFrame = steps;
+}
+
+void ParticleSimulationDriver::step() {
+    for (size_t i = 0; i < particles.size(); i++) {
+        particles[i]->getPosition(&previousPosition[i]);
+    }
+
+    const real duration = timestep / statistics.substeps;
+    for (unsigned s = 0; s < statistics.substeps; s++) {
+        registry->updateForces(duration);
+        for (size_t i = 0; i < particles.size(); i++) {
+            particles[i]->integrate(duration);
+        }
+        if (links && statistics.iterations > 0) links->solve(duration, statistics.iterations);
+    }
+    statistics.steps++;
+}
+
+void ParticleSimulationDriver::adjustQuality(bool overrun, double work) {
+    if (overrun) {
+        // Cheapen the solver first, since fewer iterations only softens the links, then take fewer substeps.
+        calmFrames = 0;
+        if (statistics.iterations > minIterations) {
+            statistics.iterations = std::max(minIterations, statistics.iterations / 2);
+        } else if (statistics.substeps > minSubsteps) {
+            statistics.substeps--;
+        }
+        return;
+    }
+
+    if (work > budget * calmFraction) {
+        calmFrames = 0;
+        return;
+    }
+    if (++calmFrames < calmFramesToRestore) return;
+
+    // Restore in the opposite order to degrading.
+    calmFrames = 0;
+    if (statistics.substeps < maxSubsteps) {
+        statistics.substeps++;
+    } else if (statistics.iterations < maxIterations) {
+        statistics.iterations = std::min(maxIterations, std::max(1u, statistics.iterations * 2));
+    }
+}
+
+real ParticleSimulationDriver::frame() {
+    const double now = clock->now();
+    if (!started) {
+        started = true;
+        lastTime = now;
+        return 0;
+    }
+    accumulator += now - lastTime;
+    lastTime = now;
+
+    bool overrun = false;
+    unsigned steps = 0;
+    while (accumulator >= timestep) {
+        if (steps == maxStepsPerFrame || clock->now() - now >= budget) {
+            // Out of time: drop the steps still owed instead of carrying them into the next frame.
+            const double dropped = std::floor(accumulator / timestep);
+            statistics.droppedSteps += (unsigned long)dropped;
+            accumulator -= dropped * timestep;
+            overrun = true;
+            break;
+        }
+        step();
+        accumulator -= timestep;
+        steps++;
+    }
+
+    const double work = clock->now() - now;
+    if (work > budget) overrun = true;
+
+    statistics.frames++;
+    if (overrun) statistics.overrunFrames++;
+    statistics.lastFrameWork = work;
+    statistics.maxFrameWork = std::max(statistics.maxFrameWork, work);
+    adjustQuality(overrun, work);
+
+    return getAlpha();
+}
+
+real ParticleSimulationDriver::getAlpha() const {
+    return (real)(accumulator / timestep);
+}
+
+Vector2D ParticleSimulationDriver::getInterpolatedPosition(unsigned index) const {
+    Vector2D position = previousPosition[index];
+    position.addScaledVector(particles[index]->getPosition() - previousPosition[index], getAlpha());
+    return position;
+}
+
+const ParticleSimulationDriver::Statistics &ParticleSimulationDriver::getStatistics() const {
+    return statistics;
+}
+
+void ParticleSimulationDriver::resetStatistics() {
+    // The current quality isn't a statistic, so keep it.
+    const unsigned substeps = statistics.substeps;
+    const unsigned iterations = statistics.iterations;
+    statistics = Statistics();
+    statistics.substeps = substeps;
+    statistics.iterations = iterations;
+}
@@ -6,6 +6,8 @@ using namespace tacoTruck;
  *  PARTICLE FORCE REGISTRY
 ***********************************************************************************************************************/
 
+ParticleForceRegistry::ParticleForceRegistry() : registrations() {}
+
 void ParticleForceRegistry::add(Particle *particle, ParticleForceGenerator *fg) {
     ParticleForceRegistration newRegistration;
     newRegistration.particle = particle;
@@ -13,6 +15,15 @@ void ParticleForceRegistry::add(Particle *particle, ParticleForceGenerator *fg)
     registrations.push_back(newRegistration);
 }
 
+void ParticleForceRegistry::add(Particle *const *particles, ParticleForceGenerator *const *fgs, unsigned count) {
+    const size_t first = registrations.size();
+    registrations.resize(first + count);
+    for (unsigned i = 0; i < count; i++) {
+        registrations[first + i].particle = particles[i];
+        registrations[first + i].fg = fgs[i];
+    }
+}
+
 void ParticleForceRegistry::remove(Particle *particle, ParticleForceGenerator *fg) {
     Registry::iterator i = registrations.begin();
     for (; i != registrations.end(); i++) {
@@ -94,9 +105,7 @@ ParticleSpring::ParticleSpring(Particle *other, real springConstant, real restLe
 
 void ParticleSpring::updateForce(Particle *particle, real duration) {
     // Calculate the vector of the spring
-    Vector2D force;
-    particle->getPosition(&force);
-    force -= other->getPosition();
+    Vector2D force = particle->getOffsetFrom(*other);
 
     // Calculate the magnitude of the force
     real magnitude = force.magnitude();
@@ -140,9 +149,7 @@ ParticleBungee::ParticleBungee(Particle *other, real springConstant, real restLe
 
 void ParticleBungee::updateForce(Particle *particle, real duration) {
     // Calculate the vector of the spring
-    Vector2D force;
-    particle->getPosition(&force);
-    force -= other->getPosition();
+    Vector2D force = particle->getOffsetFrom(*other);
 
     // Check if the bungee is compressed
     real magnitude = force.magnitude();
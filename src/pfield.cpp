@@ -0,0 +1,205 @@
+/*
+ * Implementation of the potential field force generator.
+ *
+ */
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include "pfield.hpp"
+
+using namespace tacoTruck;
+
+namespace {
+    const real twoPi = (real)6.283185307179586;
+
+    /** The number of Gauss-Seidel sweeps before and after each coarse grid correction. */
+    const unsigned smoothingSweeps = 2;
+}
+
+ParticlePotentialField::ParticlePotentialField(const Vector2D &origin, real cellSize, unsigned resolution) :
+                                                                                sourcePosition(),
+                                                                                sourceStrength(),
+                                                                                origin(origin),
+                                                                                cellSize(cellSize),
+                                                                                levels(resolution),
+                                                                                potential(resolution + 1),
+                                                                                density(resolution + 1),
+                                                                                residual(),
+                                                                                fieldX(),
+                                                                                fieldY()
+{
+    assert(resolution >= 1 && resolution < 16);
+    assert(cellSize > 0);
+
+    // Level l has 2^l + 1 points a side; level 0 is never used.
+    for (unsigned l = 1; l <= levels; l++) {
+        const size_t points = (size_t)sideOf(l) * sideOf(l);
+        potential[l].assign(points, 0);
+        density[l].assign(points, 0);
+    }
+    const size_t finest = (size_t)sideOf(levels) * sideOf(levels);
+    residual.assign(finest, 0);
+    fieldX.assign(finest, 0);
+    fieldY.assign(finest, 0);
+}
+
+unsigned ParticlePotentialField::sideOf(unsigned level) const {
+    return (1u << level) + 1;
+}
+
+void ParticlePotentialField::addSource(const Vector2D &position, real strength) {
+    sourcePosition.push_back(position);
+    sourceStrength.push_back(strength);
+}
+
+void ParticlePotentialField::clearSources() {
+    sourcePosition.clear();
+    sourceStrength.clear();
+}
+
+void ParticlePotentialField::setSourcePosition(unsigned index, const Vector2D &position) {
+    sourcePosition[index] = position;
+}
+
+void ParticlePotentialField::smooth(unsigned level, unsigned sweeps) {
+    const unsigned n = sideOf(level);
+    const real spacing = cellSize * (real)(1u << (levels - level));
+    const real h2 = spacing * spacing;
+    real *phi = &potential[level][0];
+    const real *rho = &density[level][0];
+
+    for (unsigned sweep = 0; sweep < sweeps; sweep++) {
+        for (unsigned colour = 0; colour < 2; colour++) {
+            for (unsigned j = 1; j + 1 < n; j++) {
+                for (unsigned i = 1 + ((j + colour) & 1); i + 1 < n; i += 2) {
+                    const size_t k = (size_t)j * n + i;
+                    phi[k] = (phi[k - 1] + phi[k + 1] + phi[k - n] + phi[k + n] - h2 * rho[k]) * (real)0.25;
+                }
+            }
+        }
+    }
+}
+
+void ParticlePotentialField::cycle(unsigned level) {
+    // The coarsest grid has a single interior point, which one sweep solves exactly.
+    if (level == 1) {
+        smooth(1, 1);
+        return;
+    }
+
+    smooth(level, smoothingSweeps);
+
+    // Residual of the fine grid
+    const unsigned n = sideOf(level);
+    const real spacing = cellSize * (real)(1u << (levels - level));
+    const real inverseH2 = 1 / (spacing * spacing);
+    const real *phi = &potential[level][0];
+    const real *rho = &density[level][0];
+    for (unsigned j = 1; j + 1 < n; j++) {
+        for (unsigned i = 1; i + 1 < n; i++) {
+            const size_t k = (size_t)j * n + i;
+            residual[k] = rho[k] - (phi[k - 1] + phi[k + 1] + phi[k - n] + phi[k + n] - 4 * phi[k]) * inverseH2;
+        }
+    }
+
+    // Restrict it to the coarse grid with full weighting
+    const unsigned nc = sideOf(level - 1);
+    std::vector<real> &coarseDensity = density[level - 1];
+    for (unsigned J = 1; J + 1 < nc; J++) {
+        for (unsigned I = 1; I + 1 < nc; I++) {
+            const size_t k = (size_t)(2 * J) * n + 2 * I;
+            coarseDensity[(size_t)J * nc + I] = (4 * residual[k] +
+                                                 2 * (residual[k - 1] + residual[k + 1] +
+                                                      residual[k - n] + residual[k + n]) +
+                                                 residual[k - n - 1] + residual[k - n + 1] +
+                                                 residual[k + n - 1] + residual[k + n + 1]) / 16;
+        }
+    }
+
+    // Solve for the correction on the coarse grid
+    std::fill(potential[level - 1].begin(), potential[level - 1].end(), (real)0);
+    cycle(level - 1);
+
+    // Interpolate the correction back onto the fine grid
+    const real *correction = &potential[level - 1][0];
+    real *fine = &potential[level][0];
+    for (unsigned j = 1; j + 1 < n; j++) {
+        const unsigned J0 = j / 2;
+        const unsigned J1 = (j + 1) / 2;
+        for (unsigned i = 1; i + 1 < n; i++) {
+            const unsigned I0 = i / 2;
+            const unsigned I1 = (i + 1) / 2;
+            fine[(size_t)j * n + i] += (correction[(size_t)J0 * nc + I0] + correction[(size_t)J0 * nc + I1] +
+                                        correction[(size_t)J1 * nc + I0] + correction[(size_t)J1 * nc + I1]) / 4;
+        }
+    }
+
+    smooth(level, smoothingSweeps);
+}
+
+void ParticlePotentialField::solve(unsigned cycles) {
+    const unsigned n = sideOf(levels);
+    std::vector<real> &rho = density[levels];
+    std::fill(rho.begin(), rho.end(), (real)0);
+
+    // Spread each source over the four surrounding grid points. The potential of a source of strength s is
+    // s * ln(distance), so it contributes 2 * pi * s to the integral of the density.
+    const real inverseCell = 1 / cellSize;
+    const real scale = twoPi * inverseCell * inverseCell;
+    for (size_t s = 0; s < sourcePosition.size(); s++) {
+        const Vector2D g = (sourcePosition[s] - origin) * inverseCell;
+        if (g.x < 0 || g.y < 0 || g.x >= n - 1 || g.y >= n - 1) continue;
+        const unsigned i = (unsigned)g.x;
+        const unsigned j = (unsigned)g.y;
+        const real fx = g.x - i;
+        const real fy = g.y - j;
+        const real amount = sourceStrength[s] * scale;
+        const size_t k = (size_t)j * n + i;
+        rho[k] += amount * (1 - fx) * (1 - fy);
+        rho[k + 1] += amount * fx * (1 - fy);
+        rho[k + n] += amount * (1 - fx) * fy;
+        rho[k + n + 1] += amount * fx * fy;
+    }
+
+    for (unsigned c = 0; c < cycles; c++) cycle(levels);
+
+    // The acceleration is the negative gradient of the potential.
+    const real *phi = &potential[levels][0];
+    const real inverseTwoCells = inverseCell / 2;
+    for (unsigned j = 0; j < n; j++) {
+        for (unsigned i = 0; i < n; i++) {
+            const size_t k = (size_t)j * n + i;
+            const size_t left = i > 0 ? k - 1 : k;
+            const size_t right = i + 1 < n ? k + 1 : k;
+            const size_t down = j > 0 ? k - n : k;
+            const size_t up = j + 1 < n ? k + n : k;
+            const real widthX = (right - left) == 2 ? inverseTwoCells : inverseCell;
+            const real widthY = (up - down) == 2 * (size_t)n ? inverseTwoCells : inverseCell;
+            fieldX[k] = -(phi[right] - phi[left]) * widthX;
+            fieldY[k] = -(phi[up] - phi[down]) * widthY;
+        }
+    }
+}
+
+Vector2D ParticlePotentialField::sample(const Vector2D &position) const {
+    const unsigned n = sideOf(levels);
+    const Vector2D g = (position - origin) * (1 / cellSize);
+    if (g.x < 0 || g.y < 0 || g.x >= n - 1 || g.y >= n - 1) return Vector2D();
+
+    const unsigned i = (unsigned)g.x;
+    const unsigned j = (unsigned)g.y;
+    const real fx = g.x - i;
+    const real fy = g.y - j;
+    const size_t k = (size_t)j * n + i;
+    const real w00 = (1 - fx) * (1 - fy);
+    const real w10 = fx * (1 - fy);
+    const real w01 = (1 - fx) * fy;
+    const real w11 = fx * fy;
+    return Vector2D(fieldX[k] * w00 + fieldX[k + 1] * w10 + fieldX[k + n] * w01 + fieldX[k + n + 1] * w11,
+                    fieldY[k] * w00 + fieldY[k + 1] * w10 + fieldY[k + n] * w01 + fieldY[k + n + 1] * w11);
+}
+
+void ParticlePotentialField::updateForce(Particle *particle, real duration) {
+    if (!particle->hasFiniteMass()) return;
+    particle->addForce(sample(particle->getPosition()) * particle->getMass());
+}
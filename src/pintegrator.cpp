@@ -0,0 +1,334 @@
+/*
+ * Implementation of the particle integrators.
+ *
+ */
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include "pintegrator.hpp"
+
+using namespace tacoTruck;
+
+/*******************************************************************************************************************//**
+ *  ADAPTIVE INTEGRATOR
+***********************************************************************************************************************/
+
+namespace {
+    /** Bogacki-Shampine coefficients. Each row holds the weights of the stages used to build the next stage. */
+    const real stage2[] = { (real)1/2 };
+    const real stage3[] = { 0, (real)3/4 };
+    const real stage4[] = { (real)2/9, (real)1/3, (real)4/9 };
+
+    /** Difference between the third and second order weights, used to estimate the error. */
+    const real errorWeights[] = { (real)-5/72, (real)1/12, (real)1/9, (real)-1/8 };
+
+    const real safety = (real)0.9;
+    const real minScale = (real)0.2;
+    const real maxScale = (real)5.0;
+}
+
+ParticleAdaptiveIntegrator::ParticleAdaptiveIntegrator(ParticleForceRegistry *registry, real tolerance,
+                                                       real minStep, real maxStep) :
+                                                                                registry(registry),
+                                                                                particles(),
+                                                                                tolerance(tolerance),
+                                                                                minStep(minStep),
+                                                                                maxStep(maxStep),
+                                                                                stepSize(maxStep),
+                                                                                report(),
+                                                                                startX(),
+                                                                                startY(),
+                                                                                startVelocity()
+{
+    assert(minStep > 0 && minStep <= maxStep);
+    report.stepSize = stepSize;
+    report.lastStep = 0;
+    report.acceptedSteps = 0;
+    report.rejectedSteps = 0;
+}
+
+void ParticleAdaptiveIntegrator::add(Particle *particle) {
+    particles.push_back(particle);
+}
+
+void ParticleAdaptiveIntegrator::remove(Particle *particle) {
+    std::vector<Particle*>::iterator i = std::find(particles.begin(), particles.end(), particle);
+    if (i != particles.end()) particles.erase(i);
+}
+
+void ParticleAdaptiveIntegrator::clear() {
+    particles.clear();
+}
+
+void ParticleAdaptiveIntegrator::evaluate(unsigned stage, real duration) {
+    const size_t count = particles.size();
+    for (size_t i = 0; i < count; i++) {
+        particles[i]->clearAccumulator();
+    }
+    registry->updateForces(duration);
+
+    std::vector<Vector2D> &dp = dPosition[stage];
+    std::vector<Vector2D> &dv = dVelocity[stage];
+    for (size_t i = 0; i < count; i++) {
+        const Particle *particle = particles[i];
+        const real inverseMass = particle->getInverseMass();
+        if (inverseMass <= 0.0f) {
+            dp[i].clear();
+            dv[i].clear();
+            continue;
+        }
+
+        Vector2D velocity = particle->getVelocity();
+        dp[i] = velocity;
+
+        // Acceleration from forces, plus damping as a continuous drag: d/dt(v) = v * ln(damping)
+        Vector2D acc = particle->getAcceleration();
+        acc.addScaledVector(particle->getAccumulatedForce(), inverseMass);
+        const real damping = particle->getDamping();
+        if (damping > 0.0f) acc.addScaledVector(velocity, std::log(damping));
+        dv[i] = acc;
+    }
+}
+
+void ParticleAdaptiveIntegrator::setStageState(real duration, const real *weights, unsigned stages) {
+    const size_t count = particles.size();
+    for (size_t i = 0; i < count; i++) {
+        Vector2D offset;
+        Vector2D velocity = startVelocity[i];
+        for (unsigned s = 0; s < stages; s++) {
+            offset.addScaledVector(dPosition[s][i], duration * weights[s]);
+            velocity.addScaledVector(dVelocity[s][i], duration * weights[s]);
+        }
+        particles[i]->setWorldPosition(startX[i] + offset.x, startY[i] + offset.y);
+        particles[i]->setVelocity(velocity);
+    }
+}
+
+const ParticleAdaptiveIntegrator::StepReport &ParticleAdaptiveIntegrator::integrate(real duration) {
+    assert(duration > 0.0f);
+    report.acceptedSteps = 0;
+    report.rejectedSteps = 0;
+
+    const size_t count = particles.size();
+    startX.resize(count);
+    startY.resize(count);
+    startVelocity.resize(count);
+    for (unsigned s = 0; s < 4; s++) {
+        dPosition[s].resize(count);
+        dVelocity[s].resize(count);
+    }
+    for (size_t i = 0; i < count; i++) {
+        particles[i]->getWorldPosition(&startX[i], &startY[i]);
+        particles[i]->getVelocity(&startVelocity[i]);
+    }
+
+    real remaining = duration;
+    bool firstSameAsLast = false;
+    while (remaining > 0.0f) {
+        const real h = std::min(std::max(stepSize, minStep), remaining);
+        const bool shortened = h < stepSize;
+
+        // The last stage of an accepted step is the first stage of the next one.
+        if (!firstSameAsLast) {
+            setStageState(h, stage2, 0);
+            evaluate(0, h);
+        }
+        setStageState(h, stage2, 1);
+        evaluate(1, h);
+        setStageState(h, stage3, 2);
+        evaluate(2, h);
+        setStageState(h, stage4, 3);
+        evaluate(3, h);
+
+        // Estimate the error as the difference between the third and second order solutions.
+        real error = 0;
+        for (size_t i = 0; i < count; i++) {
+            Vector2D positionError;
+            Vector2D velocityError;
+            Vector2D displacement;
+            for (unsigned s = 0; s < 4; s++) {
+                positionError.addScaledVector(dPosition[s][i], h * errorWeights[s]);
+                velocityError.addScaledVector(dVelocity[s][i], h * errorWeights[s]);
+            }
+            for (unsigned s = 0; s < 3; s++) {
+                displacement.addScaledVector(dPosition[s][i], h * stage4[s]);
+            }
+
+            // Position errors are measured against how far the particle moves, not where it is, so a particle far
+            // from the origin is held to the same tolerance as one near it.
+            const real positionScale = tolerance * (1 + displacement.magnitude());
+            const real velocityScale = tolerance * (1 + startVelocity[i].magnitude());
+            error = std::max(error, positionError.magnitude() / positionScale);
+            error = std::max(error, velocityError.magnitude() / velocityScale);
+        }
+
+        real scale = maxScale;
+        if (error > 0) scale = std::min(maxScale, std::max(minScale, safety * std::pow(1 / error, (real)1/3)));
+
+        if (error <= 1 || h <= minStep) {
+            // Accept the step; the particles already hold the third order solution.
+            for (size_t i = 0; i < count; i++) {
+                particles[i]->getWorldPosition(&startX[i], &startY[i]);
+                particles[i]->getVelocity(&startVelocity[i]);
+            }
+            dPosition[0].swap(dPosition[3]);
+            dVelocity[0].swap(dVelocity[3]);
+            firstSameAsLast = true;
+
+            remaining -= h;
+            report.lastStep = h;
+            report.acceptedSteps++;
+
+            // Don't let a step shortened to land on the end of the duration shrink the next one.
+            if (!shortened || scale < 1) stepSize = std::min(maxStep, std::max(minStep, h * scale));
+        } else {
+            // Reject the step, restore the state and retry with a smaller step.
+            setStageState(h, stage2, 0);
+            firstSameAsLast = true;
+            report.rejectedSteps++;
+            stepSize = std::max(minStep, h * scale);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        particles[i]->clearAccumulator();
+    }
+    report.stepSize = stepSize;
+    return report;
+}
+
+const ParticleAdaptiveIntegrator::StepReport &ParticleAdaptiveIntegrator::getReport() const {
+    return report;
+}
+
+real ParticleAdaptiveIntegrator::getStepSize() const {
+    return stepSize;
+}
+
+void ParticleAdaptiveIntegrator::setStepSize(const real stepSize) {
+    ParticleAdaptiveIntegrator::stepSize = stepSize;
+}
+
+void ParticleAdaptiveIntegrator::setTolerance(const real tolerance) {
+    ParticleAdaptiveIntegrator::tolerance = tolerance;
+}
+
+real ParticleAdaptiveIntegrator::getTolerance() const {
+    return tolerance;
+}
+
+/*******************************************************************************************************************//**
+ *  MULTI-RATE INTEGRATOR
+***********************************************************************************************************************/
+
+ParticleMultiRateIntegrator::ParticleMultiRateIntegrator(unsigned rateClasses) : classes(rateClasses), substep(0)
+{
+    assert(rateClasses > 0 && rateClasses < 32);
+}
+
+void ParticleMultiRateIntegrator::add(Particle *particle, unsigned rateClass, bool presented) {
+    assert(rateClass < classes.size());
+    RateClass &rc = classes[rateClass];
+    rc.particles.push_back(particle);
+    if (!presented) return;
+
+    // Keep the presented particles first. Until the class next takes a step, the particle holds its current state.
+    std::swap(rc.particles[rc.presented], rc.particles.back());
+    rc.presented++;
+    double x, y;
+    particle->getWorldPosition(&x, &y);
+    rc.startX.push_back(x);
+    rc.startY.push_back(y);
+    rc.endX.push_back(x);
+    rc.endY.push_back(y);
+    rc.startVelocity.push_back(particle->getVelocity());
+    rc.endVelocity.push_back(particle->getVelocity());
+}
+
+void ParticleMultiRateIntegrator::remove(Particle *particle) {
+    for (size_t k = 0; k < classes.size(); k++) {
+        RateClass &rc = classes[k];
+        for (size_t i = 0; i < rc.particles.size(); i++) {
+            if (rc.particles[i] != particle) continue;
+            rc.particles.erase(rc.particles.begin() + i);
+            if (i >= rc.presented) return;
+            rc.presented--;
+            rc.startX.erase(rc.startX.begin() + i);
+            rc.startY.erase(rc.startY.begin() + i);
+            rc.endX.erase(rc.endX.begin() + i);
+            rc.endY.erase(rc.endY.begin() + i);
+            rc.startVelocity.erase(rc.startVelocity.begin() + i);
+            rc.endVelocity.erase(rc.endVelocity.begin() + i);
+            return;
+        }
+    }
+}
+
+void ParticleMultiRateIntegrator::clear() {
+    for (size_t k = 0; k < classes.size(); k++) {
+        classes[k] = RateClass();
+    }
+    substep = 0;
+}
+
+ParticleForceRegistry &ParticleMultiRateIntegrator::getRegistry(unsigned rateClass) {
+    assert(rateClass < classes.size());
+    return classes[rateClass].registry;
+}
+
+unsigned ParticleMultiRateIntegrator::getRateClasses() const {
+    return (unsigned)classes.size();
+}
+
+void ParticleMultiRateIntegrator::integrate(real duration) {
+    assert(duration > 0.0f);
+    const unsigned count = (unsigned)classes.size();
+
+    // Every class is currently presented at this time, so the forces of the classes that begin a step now can be
+    // evaluated together before any of them move.
+    for (unsigned k = 0; k < count; k++) {
+        if (substep % (1u << k) != 0) continue;
+        classes[k].registry.updateForces(duration * (1u << k));
+    }
+
+    for (unsigned k = 0; k < count; k++) {
+        if (substep % (1u << k) != 0) continue;
+        RateClass &rc = classes[k];
+        const real classDuration = duration * (1u << k);
+        for (size_t i = 0; i < rc.presented; i++) {
+            Particle *particle = rc.particles[i];
+            particle->getWorldPosition(&rc.startX[i], &rc.startY[i]);
+            particle->getVelocity(&rc.startVelocity[i]);
+            particle->integrate(classDuration);
+            particle->getWorldPosition(&rc.endX[i], &rc.endY[i]);
+            particle->getVelocity(&rc.endVelocity[i]);
+        }
+        for (size_t i = rc.presented; i < rc.particles.size(); i++) {
+            rc.particles[i]->integrate(classDuration);
+        }
+    }
+
+    substep = (substep + 1) % (1u << (count - 1));
+
+    // Present the slower classes at the new time, part way through their step.
+    for (unsigned k = 1; k < count; k++) {
+        RateClass &rc = classes[k];
+        const unsigned phase = substep % (1u << k);
+        if (phase == 0) {
+            for (size_t i = 0; i < rc.presented; i++) {
+                rc.particles[i]->setWorldPosition(rc.endX[i], rc.endY[i]);
+                rc.particles[i]->setVelocity(rc.endVelocity[i]);
+            }
+            continue;
+        }
+
+        const double t = (double)phase / (double)(1u << k);
+        for (size_t i = 0; i < rc.presented; i++) {
+            Vector2D velocity = rc.startVelocity[i];
+            velocity.addScaledVector(rc.endVelocity[i] - rc.startVelocity[i], (real)t);
+            rc.particles[i]->setWorldPosition(rc.startX[i] + (rc.endX[i] - rc.startX[i]) * t,
+                                              rc.startY[i] + (rc.endY[i] - rc.startY[i]) * t);
+            rc.particles[i]->setVelocity(velocity);
+        }
+    }
+}
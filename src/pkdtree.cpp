@@ -0,0 +1,243 @@
+/*
+ * Implementation of the particle k-d tree.
+ *
+ */
+#include <assert.h>
+#include <algorithm>
+#include "pkdtree.hpp"
+
+using namespace tacoTruck;
+
+namespace {
+    /** Ranges smaller than this are built by a single thread. */
+    const unsigned serialBuildSize = 4096;
+
+    /** The number of batched queries handed to each worker at once. */
+    const unsigned queryGrain = 64;
+
+    unsigned middle(unsigned begin, unsigned end) {
+        return begin + (end - begin) / 2;
+    }
+
+    /** Returns the squared distance from the point to the closest point of the box. */
+    real squareDistanceToBox(const Vector2D &point, const Vector2D &min, const Vector2D &max) {
+        const real dx = point.x < min.x ? min.x - point.x : (point.x > max.x ? point.x - max.x : 0);
+        const real dy = point.y < min.y ? min.y - point.y : (point.y > max.y ? point.y - max.y : 0);
+        return dx * dx + dy * dy;
+    }
+}
+
+ParticleKdTree::ParticleKdTree() : nodes(), slot() {}
+
+void ParticleKdTree::split(unsigned begin, unsigned end) {
+    const unsigned m = middle(begin, end);
+    if (end - begin < 2) {
+        nodes[m].splitX = true;
+        return;
+    }
+
+    Vector2D min = nodes[begin].point;
+    Vector2D max = nodes[begin].point;
+    for (unsigned i = begin + 1; i < end; i++) {
+        const Vector2D &p = nodes[i].point;
+        min.x = std::min(min.x, p.x);
+        min.y = std::min(min.y, p.y);
+        max.x = std::max(max.x, p.x);
+        max.y = std::max(max.y, p.y);
+    }
+
+    const bool splitX = max.x - min.x >= max.y - min.y;
+    std::nth_element(nodes.begin() + begin, nodes.begin() + m, nodes.begin() + end,
+                     [splitX](const Node &a, const Node &b) {
+                         return splitX ? a.point.x < b.point.x : a.point.y < b.point.y;
+                     });
+    nodes[m].splitX = splitX;
+}
+
+void ParticleKdTree::fitNode(unsigned begin, unsigned end) {
+    const unsigned m = middle(begin, end);
+    const unsigned none = (unsigned)nodes.size();
+    Node &node = nodes[m];
+    node.left = m > begin ? middle(begin, m) : none;
+    node.right = end > m + 1 ? middle(m + 1, end) : none;
+    if (node.left != none) nodes[node.left].parent = m;
+    if (node.right != none) nodes[node.right].parent = m;
+    refitNode(m);
+}
+
+bool ParticleKdTree::refitNode(unsigned position) {
+    Node &node = nodes[position];
+    Vector2D min = node.point;
+    Vector2D max = node.point;
+    const unsigned children[] = { node.left, node.right };
+    for (unsigned c = 0; c < 2; c++) {
+        if (children[c] == nodes.size()) continue;
+        const Node &child = nodes[children[c]];
+        min.x = std::min(min.x, child.min.x);
+        min.y = std::min(min.y, child.min.y);
+        max.x = std::max(max.x, child.max.x);
+        max.y = std::max(max.y, child.max.y);
+    }
+    const bool changed = min.x != node.min.x || min.y != node.min.y || max.x != node.max.x || max.y != node.max.y;
+    node.min = min;
+    node.max = max;
+    return changed;
+}
+
+void ParticleKdTree::buildRange(unsigned begin, unsigned end) {
+    if (begin >= end) return;
+    split(begin, end);
+    const unsigned m = middle(begin, end);
+    buildRange(begin, m);
+    buildRange(m + 1, end);
+    fitNode(begin, end);
+}
+
+void ParticleKdTree::buildTop(unsigned begin, unsigned end, unsigned depth, std::vector<unsigned> &ranges) {
+    if (depth == 0 || end - begin < serialBuildSize) {
+        ranges.push_back(begin);
+        ranges.push_back(end);
+        return;
+    }
+    split(begin, end);
+    const unsigned m = middle(begin, end);
+    buildTop(begin, m, depth - 1, ranges);
+    buildTop(m + 1, end, depth - 1, ranges);
+}
+
+void ParticleKdTree::finishTop(unsigned begin, unsigned end, unsigned depth) {
+    if (depth == 0 || end - begin < serialBuildSize) return;
+    const unsigned m = middle(begin, end);
+    finishTop(begin, m, depth - 1);
+    finishTop(m + 1, end, depth - 1);
+    fitNode(begin, end);
+}
+
+void ParticleKdTree::build(Particle *const *particles, unsigned count, WorkerPool &pool) {
+    nodes.resize(count);
+    slot.resize(count);
+    if (count == 0) return;
+
+    pool.run(count, serialBuildSize, [this, particles](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; i++) {
+            nodes[i].point = particles[i]->getPosition();
+            nodes[i].id = i;
+        }
+    });
+
+    // Split the top of the tree until there are a few ranges per thread, then build those ranges in parallel.
+    unsigned depth = 0;
+    while ((1u << depth) < 4 * pool.getThreadCount()) depth++;
+    std::vector<unsigned> ranges;
+    buildTop(0, count, depth, ranges);
+    pool.run((unsigned)ranges.size() / 2, 1, [this, &ranges](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; i++) buildRange(ranges[2 * i], ranges[2 * i + 1]);
+    });
+    finishTop(0, count, depth);
+    nodes[middle(0, count)].parent = count;
+
+    pool.run(count, serialBuildSize, [this](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; i++) slot[nodes[i].id] = i;
+    });
+}
+
+void ParticleKdTree::refit(Particle *const *particles, const unsigned *moved, unsigned movedCount) {
+    const unsigned root = (unsigned)nodes.size();
+    for (unsigned i = 0; i < movedCount; i++) {
+        unsigned position = slot[moved[i]];
+        nodes[position].point = particles[moved[i]]->getPosition();
+
+        // Grow or shrink the boxes up the tree, stopping once a box no longer changes.
+        while (position != root && refitNode(position)) {
+            position = nodes[position].parent;
+        }
+    }
+}
+
+void ParticleKdTree::update(Particle *const *particles, const unsigned *moved, unsigned movedCount,
+                            real rebuildFraction, WorkerPool &pool) {
+    if (movedCount > rebuildFraction * nodes.size()) {
+        build(particles, (unsigned)nodes.size(), pool);
+    } else {
+        refit(particles, moved, movedCount);
+    }
+}
+
+unsigned ParticleKdTree::size() const {
+    return (unsigned)nodes.size();
+}
+
+void ParticleKdTree::nearestRange(unsigned begin, unsigned end, const Vector2D &point, unsigned k, unsigned &found,
+                                  unsigned *indices, real *squareDistances) const {
+    if (begin >= end) return;
+    const unsigned m = middle(begin, end);
+    const Node &node = nodes[m];
+    if (found == k && squareDistanceToBox(point, node.min, node.max) >= squareDistances[k - 1]) return;
+
+    // Insert this node's particle into the sorted list of the closest found so far.
+    const real d = (node.point - point).squareMagnitude();
+    if (found < k || d < squareDistances[k - 1]) {
+        unsigned i = found < k ? found++ : k - 1;
+        for (; i > 0 && squareDistances[i - 1] > d; i--) {
+            squareDistances[i] = squareDistances[i - 1];
+            indices[i] = indices[i - 1];
+        }
+        squareDistances[i] = d;
+        indices[i] = node.id;
+    }
+
+    // Search the side of the split containing the point first.
+    const real side = node.splitX ? point.x - node.point.x : point.y - node.point.y;
+    if (side < 0) {
+        nearestRange(begin, m, point, k, found, indices, squareDistances);
+        nearestRange(m + 1, end, point, k, found, indices, squareDistances);
+    } else {
+        nearestRange(m + 1, end, point, k, found, indices, squareDistances);
+        nearestRange(begin, m, point, k, found, indices, squareDistances);
+    }
+}
+
+unsigned ParticleKdTree::nearest(const Vector2D &point, unsigned k, unsigned *indices, real *squareDistances) const {
+    unsigned found = 0;
+    if (k > 0) nearestRange(0, (unsigned)nodes.size(), point, k, found, indices, squareDistances);
+    return found;
+}
+
+unsigned ParticleKdTree::nearest(const Vector2D &point) const {
+    assert(!nodes.empty());
+    unsigned index = 0;
+    real squareDistance = 0;
+    nearest(point, 1, &index, &squareDistance);
+    return index;
+}
+
+void ParticleKdTree::radiusRange(unsigned begin, unsigned end, const Vector2D &point, real squareRadius,
+                                 std::vector<unsigned> &result) const {
+    if (begin >= end) return;
+    const unsigned m = middle(begin, end);
+    const Node &node = nodes[m];
+    if (squareDistanceToBox(point, node.min, node.max) > squareRadius) return;
+    if ((node.point - point).squareMagnitude() <= squareRadius) result.push_back(node.id);
+    radiusRange(begin, m, point, squareRadius, result);
+    radiusRange(m + 1, end, point, squareRadius, result);
+}
+
+unsigned ParticleKdTree::withinRadius(const Vector2D &point, real radius, std::vector<unsigned> &result) const {
+    const size_t before = result.size();
+    radiusRange(0, (unsigned)nodes.size(), point, radius * radius, result);
+    return (unsigned)(result.size() - before);
+}
+
+void ParticleKdTree::nearest(const Vector2D *points, unsigned count, unsigned k, unsigned *indices,
+                             real *squareDistances, WorkerPool &pool) const {
+    pool.run(count, queryGrain, [this, points, k, indices, squareDistances](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; i++) {
+            unsigned *index = indices + (size_t)i * k;
+            real *squareDistance = squareDistances + (size_t)i * k;
+            for (unsigned found = nearest(points[i], k, index, squareDistance); found < k; found++) {
+                index[found] = (unsigned)nodes.size();
+                squareDistance[found] = REAL_MAX;
+            }
+        }
+    });
+}
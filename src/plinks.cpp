@@ -0,0 +1,211 @@
+/*
+ * Implementation of the particle link solver.
+ *
+ */
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "plinks.hpp"
+
+using namespace tacoTruck;
+
+namespace {
+    /** Links are colored with up to this many colors; any left over go in one more color that is solved serially. */
+    const unsigned maxColors = 64;
+
+    /** The number of links or particles handed to each worker at once. */
+    const unsigned grain = 2048;
+}
+
+ParticleLinkSolver::ParticleLinkSolver() : particles(),
+                                           linkA(), linkB(), linkLength(), linkIsRod(),
+                                           colorStart(), colored(true), reference(),
+                                           positionX(), positionY(), startX(), startY(), inverseMass()
+{}
+
+unsigned ParticleLinkSolver::add(Particle *particle) {
+    // Until a link joins it to others, a particle is its own reference.
+    particles.push_back(particle);
+    reference.push_back((unsigned)particles.size() - 1);
+    return (unsigned)particles.size() - 1;
+}
+
+void ParticleLinkSolver::addLink(unsigned a, unsigned b, real length, bool rod) {
+    assert(a < particles.size() && b < particles.size() && a != b);
+    linkA.push_back(a);
+    linkB.push_back(b);
+    linkLength.push_back(length);
+    linkIsRod.push_back(rod ? 1 : 0);
+    colored = false;
+}
+
+void ParticleLinkSolver::add(const ParticleCable &cable) {
+    addLink(cable.a, cable.b, cable.maxLength, false);
+}
+
+void ParticleLinkSolver::add(const ParticleRod &rod) {
+    addLink(rod.a, rod.b, rod.length, true);
+}
+
+void ParticleLinkSolver::clear() {
+    particles.clear();
+    linkA.clear();
+    linkB.clear();
+    linkLength.clear();
+    linkIsRod.clear();
+    colorStart.clear();
+    reference.clear();
+    colored = true;
+}
+
+unsigned ParticleLinkSolver::getLinkCount() const {
+    return (unsigned)linkA.size();
+}
+
+unsigned ParticleLinkSolver::getColorCount() {
+    if (!colored) color();
+    return colorStart.empty() ? 0 : (unsigned)colorStart.size() - 1;
+}
+
+void ParticleLinkSolver::color() {
+    const unsigned count = (unsigned)linkA.size();
+
+    // Greedy coloring: each link takes the lowest color not yet used by a link on either of its particles.
+    std::vector<uint64_t> used(particles.size(), 0);
+    std::vector<unsigned> linkColor(count);
+    std::vector<unsigned> colorCount(maxColors + 1, 0);
+    for (unsigned i = 0; i < count; i++) {
+        const uint64_t taken = used[linkA[i]] | used[linkB[i]];
+        unsigned c = 0;
+        while (c < maxColors && (taken & ((uint64_t)1 << c))) c++;
+        if (c < maxColors) {
+            used[linkA[i]] |= (uint64_t)1 << c;
+            used[linkB[i]] |= (uint64_t)1 << c;
+        }
+        linkColor[i] = c;
+        colorCount[c]++;
+    }
+
+    // Reorder the links so that each color is contiguous.
+    unsigned colors = maxColors + 1;
+    while (colors > 0 && colorCount[colors - 1] == 0) colors--;
+    colorStart.assign(colors + 1, 0);
+    for (unsigned c = 0; c < colors; c++) colorStart[c + 1] = colorStart[c] + colorCount[c];
+
+    std::vector<unsigned> next(colorStart.begin(), colorStart.end() - 1);
+    std::vector<unsigned> a(count), b(count);
+    std::vector<real> length(count);
+    std::vector<unsigned char> rod(count);
+    for (unsigned i = 0; i < count; i++) {
+        const unsigned to = next[linkColor[i]]++;
+        a[to] = linkA[i];
+        b[to] = linkB[i];
+        length[to] = linkLength[i];
+        rod[to] = linkIsRod[i];
+    }
+    linkA.swap(a);
+    linkB.swap(b);
+    linkLength.swap(length);
+    linkIsRod.swap(rod);
+    findReferences();
+    colored = true;
+}
+
+void ParticleLinkSolver::findReferences() {
+    // Union-find over the links; the root of each group becomes its reference.
+    const unsigned count = (unsigned)particles.size();
+    for (unsigned i = 0; i < count; i++) reference[i] = i;
+
+    for (size_t i = 0; i < linkA.size(); i++) {
+        unsigned a = linkA[i];
+        unsigned b = linkB[i];
+        while (reference[a] != a) a = reference[a] = reference[reference[a]];
+        while (reference[b] != b) b = reference[b] = reference[reference[b]];
+        if (a != b) reference[std::max(a, b)] = std::min(a, b);
+    }
+
+    // A particle's parent always has a lower index, so one pass in order leaves every particle pointing at its root.
+    for (unsigned i = 0; i < count; i++) reference[i] = reference[reference[i]];
+}
+
+void ParticleLinkSolver::solveLinks(unsigned begin, unsigned end) {
+    real *x = &positionX[0];
+    real *y = &positionY[0];
+    const real *w = &inverseMass[0];
+    for (unsigned i = begin; i < end; i++) {
+        const unsigned a = linkA[i];
+        const unsigned b = linkB[i];
+        const real dx = x[b] - x[a];
+        const real dy = y[b] - y[a];
+        const real distance = std::sqrt(dx * dx + dy * dy);
+        const real error = distance - linkLength[i];
+
+        // Cables only act when stretched.
+        if (error <= 0 && !linkIsRod[i]) continue;
+
+        const real totalInverseMass = w[a] + w[b];
+        if (totalInverseMass <= 0 || distance <= 0) continue;
+
+        // Move each end along the link, in proportion to its inverse mass.
+        const real scale = error / (totalInverseMass * distance);
+        x[a] += dx * scale * w[a];
+        y[a] += dy * scale * w[a];
+        x[b] -= dx * scale * w[b];
+        y[b] -= dy * scale * w[b];
+    }
+}
+
+void ParticleLinkSolver::solve(real duration, unsigned iterations, WorkerPool &pool) {
+    assert(duration > 0.0f);
+    if (linkA.empty()) return;
+    if (!colored) color();
+
+    const unsigned count = (unsigned)particles.size();
+    positionX.resize(count);
+    positionY.resize(count);
+    startX.resize(count);
+    startY.resize(count);
+    inverseMass.resize(count);
+
+    pool.run(count, grain, [this](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; i++) {
+            const Particle *particle = particles[i];
+            const Vector2D position = particle->getOffsetFrom(*particles[reference[i]]);
+            startX[i] = positionX[i] = position.x;
+            startY[i] = positionY[i] = position.y;
+            inverseMass[i] = std::max((real)0, particle->getInverseMass());
+        }
+    });
+
+    const unsigned colors = (unsigned)colorStart.size() - 1;
+    for (unsigned iteration = 0; iteration < iterations; iteration++) {
+        for (unsigned c = 0; c < colors; c++) {
+            const unsigned first = colorStart[c];
+            const unsigned links = colorStart[c + 1] - first;
+
+            // The overflow color may have links sharing particles, so it can't be split up.
+            if (c == maxColors) {
+                solveLinks(first, first + links);
+                continue;
+            }
+            pool.run(links, grain, [this, first](unsigned begin, unsigned end) {
+                solveLinks(first + begin, first + end);
+            });
+        }
+    }
+
+    // Write back the positions, and change the velocities by the distance moved over the step.
+    const real inverseDuration = 1 / duration;
+    pool.run(count, grain, [this, inverseDuration](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; i++) {
+            const Vector2D moved(positionX[i] - startX[i], positionY[i] - startY[i]);
+            if (moved.x == 0 && moved.y == 0) continue;
+            Particle *particle = particles[i];
+            particle->translate(moved);
+            Vector2D velocity = particle->getVelocity();
+            velocity.addScaledVector(moved, inverseDuration);
+            particle->setVelocity(velocity);
+        }
+    });
+}
@@ -0,0 +1,345 @@
+/*
+ * Implementation of particle scenarios and the scenario file format.
+ *
+ */
+#include <assert.h>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include "pscenario.hpp"
+
+using namespace tacoTruck;
+
+namespace {
+    /** The number of particles in each block of storage. */
+    const unsigned blockShift = 16;
+    const unsigned blockSize = 1u << blockShift;
+
+    /** The number of items handed to each worker at once. */
+    const unsigned grain = 4096;
+
+    const char magic[4] = { 'T', 'T', 'S', 'C' };
+    const uint32_t version = 1;
+    const unsigned columnCount = 8;
+
+    /** Indices are stored in the file as 32 bit values, and read straight into unsigned arrays. */
+    static_assert(sizeof(unsigned) == sizeof(uint32_t), "unsigned must be 32 bits");
+
+    bool readValues(std::FILE *file, void *data, size_t size, size_t count) {
+        return std::fread(data, size, count, file) == count;
+    }
+
+    /**
+     *  Reads count values onto the end of the given vector a piece at a time, growing it only as the values arrive, so
+     *  that a count from a damaged file can't cause a huge allocation before the read fails.
+     */
+    template <typename T>
+    bool readGrowing(std::FILE *file, std::vector<T> &values, size_t count) {
+        const size_t piece = 1u << 16;
+        for (size_t done = 0; done < count; ) {
+            const size_t n = std::min(piece, count - done);
+            const size_t at = values.size();
+            values.resize(at + n);
+            if (!readValues(file, &values[at], sizeof(T), n)) return false;
+            done += n;
+        }
+        return true;
+    }
+}
+
+/*******************************************************************************************************************//**
+ *  PARTICLE SCENARIO
+***********************************************************************************************************************/
+
+ParticleScenario::ParticleScenario() : blocks(), particleCount(0), generators(), anchors(), registry() {}
+
+ParticleScenario::~ParticleScenario() {
+    clear();
+}
+
+void ParticleScenario::clear() {
+    registry.clear();
+    for (size_t i = 0; i < generators.size(); i++) delete generators[i];
+    generators.clear();
+    anchors.clear();
+    for (size_t i = 0; i < blocks.size(); i++) delete[] blocks[i];
+    blocks.clear();
+    particleCount = 0;
+}
+
+unsigned ParticleScenario::addParticles(unsigned count) {
+    const unsigned first = particleCount;
+    particleCount += count;
+    while (blocks.size() * blockSize < particleCount) {
+        blocks.push_back(new Particle[blockSize]);
+    }
+    return first;
+}
+
+void ParticleScenario::setParticles(unsigned first, unsigned count, const ParticleColumns &columns,
+                                    WorkerPool &pool) {
+    assert(first + count <= particleCount);
+    pool.run(count, grain, [this, first, &columns](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; i++) {
+            Particle *particle = getParticle(first + i);
+            particle->setInverseMass(columns.inverseMass[i]);
+            particle->setPosition(columns.positionX[i], columns.positionY[i]);
+            particle->setVelocity(columns.velocityX[i], columns.velocityY[i]);
+            particle->setAcceleration(columns.accelerationX[i], columns.accelerationY[i]);
+            particle->setDamping(columns.damping[i]);
+        }
+    });
+}
+
+Particle *ParticleScenario::getParticle(unsigned index) {
+    assert(index < particleCount);
+    return blocks[index >> blockShift] + (index & (blockSize - 1));
+}
+
+unsigned ParticleScenario::getParticleCount() const {
+    return particleCount;
+}
+
+bool ParticleScenario::addGenerator(const ParticleGeneratorRecord &record, unsigned *index) {
+    const bool needsOther = record.type == ParticleGeneratorRecord::SPRING ||
+                            record.type == ParticleGeneratorRecord::BUNGEE;
+    if (needsOther && record.other >= particleCount) return false;
+
+    const real *p = record.params;
+    ParticleForceGenerator *fg = nullptr;
+    switch (record.type) {
+        case ParticleGeneratorRecord::GRAVITY:
+            fg = new ParticleGravity(Vector2D(p[0], p[1]));
+            break;
+        case ParticleGeneratorRecord::DRAG:
+            fg = new ParticleDrag(p[0], p[1]);
+            break;
+        case ParticleGeneratorRecord::SPRING:
+            fg = new ParticleSpring(getParticle(record.other), p[0], p[1]);
+            break;
+        case ParticleGeneratorRecord::ANCHORED_SPRING:
+            anchors.push_back(Vector2D(p[0], p[1]));
+            fg = new ParticleAnchoredSpring(&anchors.back(), p[2], p[3]);
+            break;
+        case ParticleGeneratorRecord::BUNGEE:
+            fg = new ParticleBungee(getParticle(record.other), p[0], p[1]);
+            break;
+        case ParticleGeneratorRecord::UPLIFT:
+            fg = new ParticleUplift(Vector2D(p[0], p[1]), Vector2D(p[2], p[3]), p[4]);
+            break;
+        case ParticleGeneratorRecord::AIRBRAKE:
+            fg = new ParticleAirbrake(p[0], p[1], p[2] != 0);
+            break;
+        case ParticleGeneratorRecord::ATTRACTION:
+            fg = new ParticleAttraction(p[0], Vector2D(p[1], p[2]));
+            break;
+        default:
+            return false;
+    }
+    const unsigned added = addGenerator(fg);
+    if (index) *index = added;
+    return true;
+}
+
+unsigned ParticleScenario::addGenerator(ParticleForceGenerator *fg) {
+    generators.push_back(fg);
+    return (unsigned)generators.size() - 1;
+}
+
+ParticleForceGenerator *ParticleScenario::getGenerator(unsigned index) {
+    return generators[index];
+}
+
+unsigned ParticleScenario::getGeneratorCount() const {
+    return (unsigned)generators.size();
+}
+
+void ParticleScenario::addRegistrations(const unsigned *particles, const unsigned *generators, unsigned count,
+                                        WorkerPool &pool) {
+    std::vector<Particle*> particlePointers(count);
+    std::vector<ParticleForceGenerator*> generatorPointers(count);
+    pool.run(count, grain, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i < end; i++) {
+            particlePointers[i] = getParticle(particles[i]);
+            generatorPointers[i] = ParticleScenario::generators[generators[i]];
+        }
+    });
+    registry.add(particlePointers.data(), generatorPointers.data(), count);
+}
+
+ParticleForceRegistry &ParticleScenario::getRegistry() {
+    return registry;
+}
+
+bool ParticleScenario::load(const char *path, WorkerPool &pool) {
+    std::FILE *file = std::fopen(path, "rb");
+    if (!file) return false;
+
+    // Header
+    char fileMagic[4];
+    uint32_t header[5];
+    if (!readValues(file, fileMagic, 1, 4) || std::memcmp(fileMagic, magic, 4) != 0 ||
+        !readValues(file, header, sizeof(uint32_t), 5) || header[0] != version || header[1] != sizeof(real)) {
+        std::fclose(file);
+        return false;
+    }
+    const unsigned fileParticles = header[2];
+    const unsigned fileGenerators = header[3];
+    const unsigned fileRegistrations = header[4];
+
+    // Nothing is allocated from the counts in the header or in a chunk until the data they describe has been read, so
+    // a damaged count makes the load fail rather than reserve room for billions of particles.
+    const unsigned particleBase = particleCount;
+    const unsigned generatorBase = (unsigned)generators.size();
+
+    // Particles, one chunk at a time
+    bool ok = true;
+    std::vector<real> values;
+    for (unsigned loaded = 0; ok && loaded < fileParticles; ) {
+        uint32_t count = 0;
+        ok = readValues(file, &count, sizeof(count), 1) && count > 0 && count <= fileParticles - loaded;
+        if (!ok) break;
+
+        values.clear();
+        ok = readGrowing(file, values, (size_t)count * columnCount);
+        if (!ok) break;
+
+        const real *column = values.data();
+        ParticleColumns columns = { column, column + count, column + 2 * count, column + 3 * count,
+                                    column + 4 * count, column + 5 * count, column + 6 * count, column + 7 * count };
+        addParticles(count);
+        setParticles(particleBase + loaded, count, columns, pool);
+        loaded += count;
+    }
+
+    // Generators
+    for (unsigned i = 0; ok && i < fileGenerators; i++) {
+        ParticleGeneratorRecord record;
+        uint32_t ids[2];
+        ok = readValues(file, ids, sizeof(uint32_t), 2) && readValues(file, record.params, sizeof(real), 6);
+        if (!ok) break;
+
+        record.type = ids[0];
+        record.other = particleBase + ids[1];
+        const bool needsOther = record.type == ParticleGeneratorRecord::SPRING ||
+                                record.type == ParticleGeneratorRecord::BUNGEE;
+        ok = (!needsOther || ids[1] < fileParticles) && addGenerator(record);
+    }
+
+    // Registrations, one chunk at a time
+    std::vector<unsigned> indices;
+    for (unsigned loaded = 0; ok && loaded < fileRegistrations; ) {
+        uint32_t count = 0;
+        ok = readValues(file, &count, sizeof(count), 1) && count > 0 && count <= fileRegistrations - loaded;
+        if (!ok) break;
+
+        indices.clear();
+        ok = readGrowing(file, indices, 2 * (size_t)count);
+        if (!ok) break;
+
+        unsigned *particles = indices.data();
+        unsigned *fgs = indices.data() + count;
+        for (unsigned i = 0; ok && i < count; i++) {
+            ok = particles[i] < fileParticles && fgs[i] < fileGenerators;
+            particles[i] += particleBase;
+            fgs[i] += generatorBase;
+        }
+        if (ok) addRegistrations(particles, fgs, count, pool);
+        loaded += count;
+    }
+
+    std::fclose(file);
+    return ok;
+}
+
+/*******************************************************************************************************************//**
+ *  SCENARIO WRITER
+***********************************************************************************************************************/
+
+ParticleScenarioWriter::ParticleScenarioWriter() : file(nullptr),
+                                                   particleCount(0),
+                                                   generatorCount(0),
+                                                   registrationCount(0),
+                                                   written(0),
+                                                   section(0),
+                                                   failed(false)
+{}
+
+ParticleScenarioWriter::~ParticleScenarioWriter() {
+    if (file) std::fclose(file);
+}
+
+void ParticleScenarioWriter::write(const void *data, size_t size, size_t count) {
+    if (!failed && std::fwrite(data, size, count, file) != count) failed = true;
+}
+
+void ParticleScenarioWriter::advance() {
+    const unsigned expected[] = { particleCount, generatorCount, registrationCount };
+    while (section < 3 && written == expected[section]) {
+        section++;
+        written = 0;
+    }
+}
+
+bool ParticleScenarioWriter::open(const char *path, unsigned particleCount, unsigned generatorCount,
+                                  unsigned registrationCount) {
+    assert(!file);
+    file = std::fopen(path, "wb");
+    if (!file) return false;
+
+    ParticleScenarioWriter::particleCount = particleCount;
+    ParticleScenarioWriter::generatorCount = generatorCount;
+    ParticleScenarioWriter::registrationCount = registrationCount;
+    written = 0;
+    section = 0;
+    failed = false;
+
+    const uint32_t header[5] = { version, (uint32_t)sizeof(real), particleCount, generatorCount, registrationCount };
+    write(magic, 1, 4);
+    write(header, sizeof(uint32_t), 5);
+    advance();
+    return !failed;
+}
+
+void ParticleScenarioWriter::writeParticles(unsigned count, const ParticleColumns &columns) {
+    assert(section == 0 && written + count <= particleCount);
+    if (count == 0) return;
+
+    const uint32_t chunk = count;
+    write(&chunk, sizeof(chunk), 1);
+    const real *column[columnCount] = { columns.inverseMass, columns.positionX, columns.positionY,
+                                        columns.velocityX, columns.velocityY,
+                                        columns.accelerationX, columns.accelerationY, columns.damping };
+    for (unsigned c = 0; c < columnCount; c++) write(column[c], sizeof(real), count);
+    written += count;
+    advance();
+}
+
+void ParticleScenarioWriter::writeGenerator(const ParticleGeneratorRecord &record) {
+    assert(section == 1);
+    const uint32_t ids[2] = { record.type, record.other };
+    write(ids, sizeof(uint32_t), 2);
+    write(record.params, sizeof(real), 6);
+    written++;
+    advance();
+}
+
+void ParticleScenarioWriter::writeRegistrations(const unsigned *particles, const unsigned *generators,
+                                                unsigned count) {
+    assert(section == 2 && written + count <= registrationCount);
+    if (count == 0) return;
+
+    const uint32_t chunk = count;
+    write(&chunk, sizeof(chunk), 1);
+    write(particles, sizeof(unsigned), count);
+    write(generators, sizeof(unsigned), count);
+    written += count;
+    advance();
+}
+
+bool ParticleScenarioWriter::close() {
+    if (!file) return false;
+    const bool ok = std::fclose(file) == 0 && !failed && section == 3;
+    file = nullptr;
+    return ok;
+}